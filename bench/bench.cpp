@@ -0,0 +1,229 @@
+
+/// System/STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+/// Local files
+#include "fps.h"
+
+
+using namespace FramesPerSecond;
+
+
+/// /////////////////////////////////////////////////////////////////
+/// Allocation accounting (for the memory footprint numbers)
+/// /////////////////////////////////////////////////////////////////
+
+static std::atomic<std::size_t> g_allocated_bytes(0);
+
+/// Kept out of line, so that GCC does not match malloc() against delete
+__attribute__((noinline)) void* operator new(std::size_t size)
+{
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void* pointer = std::malloc(size ? size : 1);
+  if (!pointer)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+__attribute__((noinline)) void operator delete(void* pointer) noexcept
+{
+  std::free(pointer);
+}
+
+__attribute__((noinline)) void operator delete(void* pointer,
+                                               std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+
+/// /////////////////////////////////////////////////////////////////
+/// Helpers
+/// /////////////////////////////////////////////////////////////////
+
+/// Keep the compiler from discarding benchmarked results
+static volatile float g_sink;
+
+static double SecondsSince(const TIME_POINT_T& start)
+{
+  return std::chrono::duration<double>(Now()-start).count();
+}
+
+/**
+ * Run "ops_per_thread" calls of "estimator.AddSample()" on each of
+ * "threads" threads at the same time.
+ *
+ * @returns the wall-clock nanoseconds per call and thread
+ */
+template <typename EstimatorT>
+static double TimeAddSample(EstimatorT& estimator,
+                            unsigned int threads,
+                            std::size_t ops_per_thread)
+{
+  std::atomic<unsigned int> ready(0);
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&]() {
+      ready.fetch_add(1);
+      while (!go.load())
+        std::this_thread::yield();
+      for (std::size_t i = 0; i < ops_per_thread; ++i)
+        estimator.AddSample();
+    }));
+  }
+  while (ready.load() < threads)
+    std::this_thread::yield();
+
+  const TIME_POINT_T start = Now();
+  go.store(true);
+  for (std::size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  return SecondsSince(start) * 1e9 / ops_per_thread;
+}
+
+/**
+ * Fill "estimator" with "count" samples evenly spread over the past
+ * "span_seconds" seconds
+ */
+template <typename EstimatorT>
+static void FillHistory(EstimatorT& estimator,
+                        std::size_t count,
+                        float span_seconds)
+{
+  const TIME_POINT_T now = Now();
+  const int64_t span = SecondsToTicks(span_seconds);
+  std::vector<TIME_POINT_T> samples(count);
+  for (std::size_t i = 0; i < count; ++i)
+    samples[i] = now - TIME_RESOLUTION_T(span - span/count*i);
+  estimator.AddSamples(samples.data(), samples.data()+samples.size());
+}
+
+/// Average nanoseconds per call of "estimator.FPS(window, false, method)"
+static double TimeFPS(FPSEstimator& estimator,
+                      float window_seconds,
+                      FPSEstimator::EstimationMethod method)
+{
+  std::size_t calls = 0;
+  const TIME_POINT_T start = Now();
+  do {
+    for (int i = 0; i < 8; ++i)
+      g_sink = estimator.FPS(window_seconds, false, method);
+    calls += 8;
+  } while (SecondsSince(start) < 0.05);
+  return SecondsSince(start) * 1e9 / calls;
+}
+
+/// Average nanoseconds per call of "estimator.FPS(window)"
+template <typename EstimatorT>
+static double TimeBucketedFPS(EstimatorT& estimator,
+                              float window_seconds)
+{
+  std::size_t calls = 0;
+  const TIME_POINT_T start = Now();
+  do {
+    for (int i = 0; i < 8; ++i)
+      g_sink = estimator.FPS(window_seconds);
+    calls += 8;
+  } while (SecondsSince(start) < 0.05);
+  return SecondsSince(start) * 1e9 / calls;
+}
+
+
+/// /////////////////////////////////////////////////////////////////
+/// Benchmarks
+/// /////////////////////////////////////////////////////////////////
+
+static void BenchAddSample(unsigned int max_threads)
+{
+  const std::size_t ops = 1000000;
+  std::printf("\nAddSample(): ns/op per thread (%zu ops per thread)\n", ops);
+  std::printf("%8s %14s %14s %14s\n",
+              "threads", "FPSEstimator", "Bucketed", "Sharded");
+  for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+    FPSEstimator ring;
+    BucketedFPSEstimator bucketed;
+    ShardedFPSEstimator sharded(threads);
+    const double ring_ns     = TimeAddSample(ring, threads, ops);
+    const double bucketed_ns = TimeAddSample(bucketed, threads, ops);
+    const double sharded_ns  = TimeAddSample(sharded, threads, ops);
+    std::printf("%8u %14.1f %14.1f %14.1f\n",
+                threads, ring_ns, bucketed_ns, sharded_ns);
+  }
+}
+
+static void BenchFPS()
+{
+  const float span_seconds = 10.f;
+  const float windows[] = {0.1f, 1.f, 5.f};
+  const std::size_t histories[] = {1000, 10000, 100000, 1000000};
+
+  std::printf("\nFPS(): ns/call (history spread over %.0fs)\n", span_seconds);
+  std::printf("%10s %8s %16s %16s\n",
+              "history", "window", "CountSamples", "AverageIntervals");
+  for (std::size_t h = 0; h < sizeof(histories)/sizeof(histories[0]); ++h) {
+    FPSEstimator estimator(histories[h]);
+    FillHistory(estimator, histories[h], span_seconds);
+    for (std::size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); ++w) {
+      const double count_ns = TimeFPS(estimator, windows[w],
+                                      FPSEstimator::CountSamples);
+      const double average_ns = TimeFPS(estimator, windows[w],
+                                        FPSEstimator::AverageIntervals);
+      std::printf("%10zu %7.1fs %16.0f %16.0f\n",
+                  histories[h], windows[w], count_ns, average_ns);
+    }
+  }
+
+  std::printf("\nBucketedFPSEstimator::FPS(): ns/call (1ms buckets)\n");
+  std::printf("%8s %10s\n", "window", "ns/call");
+  BucketedFPSEstimator bucketed;
+  FillHistory(bucketed, 100000, span_seconds);
+  for (std::size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); ++w)
+    std::printf("%7.1fs %10.0f\n",
+                windows[w], TimeBucketedFPS(bucketed, windows[w]));
+}
+
+static void BenchMemory()
+{
+  std::printf("\nMemory footprint (heap + object)\n");
+  const std::size_t capacities[] = {1024, 16384, 1048576};
+  for (std::size_t c = 0; c < sizeof(capacities)/sizeof(capacities[0]); ++c) {
+    const std::size_t before = g_allocated_bytes.load();
+    FPSEstimator* estimator = new FPSEstimator(capacities[c]);
+    const std::size_t bytes = g_allocated_bytes.load() - before;
+    std::printf("  FPSEstimator(%zu): %zu bytes, %.2f bytes/retained sample\n",
+                capacities[c], bytes,
+                static_cast<double>(bytes) / capacities[c]);
+    delete estimator;
+  }
+
+  const std::size_t before = g_allocated_bytes.load();
+  BucketedFPSEstimator* bucketed = new BucketedFPSEstimator();
+  std::printf("  BucketedFPSEstimator(1ms, 10s): %zu bytes, independent of rate\n",
+              g_allocated_bytes.load() - before);
+  delete bucketed;
+}
+
+
+
+int main(int argc, char** argv) {
+
+  (void)argc;
+  (void)argv;
+
+  unsigned int max_threads = std::thread::hardware_concurrency();
+  max_threads = std::max(4u, max_threads);
+
+  BenchMemory();
+  BenchAddSample(max_threads);
+  BenchFPS();
+
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,939 @@
+
+/// System/STL
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+/// Local files
+#include "fps.h"
+
+
+using namespace FramesPerSecond;
+
+
+/// /////////////////////////////////////////////////////////////////
+/// Helpers
+/// /////////////////////////////////////////////////////////////////
+
+/// Number of failed checks
+static std::atomic<int> g_failures(0);
+
+/// Record a failed check if "condition" is FALSE
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      std::printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__,         \
+                  #condition);                                        \
+      ++g_failures;                                                   \
+    }                                                                 \
+  } while (0)
+
+/// TRUE iff "value" is within "tolerance" (relative) of "expected"
+static bool Near(double value, double expected, double tolerance)
+{
+  return std::fabs(value-expected) <= tolerance*std::fabs(expected);
+}
+
+/**
+ * Clock that only moves when told to, for deterministic windows. Only
+ * set "now" while no other thread reads it.
+ */
+struct ManualClock {
+  static int64_t now;
+
+  static TIME_POINT_T Now()
+  {
+    return TIME_POINT_T(TIME_RESOLUTION_T(now));
+  }
+
+  static TIME_POINT_T At(int64_t ticks)
+  {
+    return TIME_POINT_T(TIME_RESOLUTION_T(ticks));
+  }
+};
+
+int64_t ManualClock::now = 0;
+
+/// Start of all manual timelines (far from the epoch, like a real clock)
+static const int64_t START = 1000000000000LL;
+
+/// Defined in the second translation unit (check_link.cpp)
+float OtherTranslationUnitFPS();
+
+/// Run "body(thread_index)" on "threads" threads that start together
+static void RunThreads(unsigned int threads,
+                       const std::function<void(unsigned int)>& body)
+{
+  std::atomic<unsigned int> ready(0);
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      ready.fetch_add(1);
+      while (ready.load() < threads)
+        std::this_thread::yield();
+      body(t);
+    }));
+  }
+  for (std::size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+}
+
+
+/// /////////////////////////////////////////////////////////////////
+/// Checks
+/// /////////////////////////////////////////////////////////////////
+
+/// Samples beyond the ring capacity are evicted, oldest first
+static void CheckRingWrapAround()
+{
+  std::printf("Ring wrap-around\n");
+  BasicFPSEstimator<ManualClock> estimator(16);
+  for (int i = 0; i < 100; ++i) {
+    ManualClock::now = START + i*10000000LL;
+    estimator.AddSample();
+  }
+  /// 10 of the retained 16 samples lie in the past 0.1 s ...
+  CHECK(Near(estimator.FPS(0.1f), 100., 0.11));
+  /// ... but 1 s would need 100 of them
+  CHECK(estimator.FPS(1.f) < 0.f);
+
+  estimator.Reset();
+  CHECK(estimator.FPS(0.1f) < 0.f);
+
+  /// The default capacity covers 1 s at 50 kHz
+  BasicFPSEstimator<ManualClock> fast;
+  for (int i = 0; i < 60000; ++i) {
+    ManualClock::now = START + i*20000LL;
+    fast.AddSample();
+  }
+  CHECK(Near(fast.FPS(1.f), 50000., 1e-3));
+}
+
+/// Bucket sums, partial buckets and eviction in the timing wheel
+static void CheckCounterWheel()
+{
+  std::printf("Counter wheel\n");
+  /// 1 ms buckets; 10 ms need 12 slots, rounded up to 16
+  CounterWheel wheel(std::chrono::milliseconds(1), 0.01f);
+  CHECK(wheel.Size() == 16);
+  const int64_t ms = 1000000;
+  wheel.Add(100*ms + 200000, 10);
+  wheel.Add(101*ms, 4);
+  wheel.Add(101*ms + 999999, 2);
+  CHECK(wheel.Sum(100*ms, 101*ms + 999999) == 16.);
+  /// Half of the first bucket lies inside the range
+  CHECK(wheel.Sum(100*ms + 500000, 102*ms) == 11.);
+  CHECK(wheel.Sum(80*ms, 102*ms) < 0.);
+
+  /// Bucket 116 shares bucket 100's slot and evicts it exactly once
+  int64_t evicted_bucket = 0;
+  uint32_t evicted_count = 0;
+  CHECK(wheel.Add(116*ms, 1, evicted_bucket, evicted_count));
+  CHECK(evicted_bucket == 100 && evicted_count == 10);
+  CHECK(!wheel.Add(116*ms, 1, evicted_bucket, evicted_count));
+  CHECK(wheel.Sum(101*ms, 116*ms) == 8.);
+
+  wheel.Clear();
+  CHECK(wheel.Sum(101*ms, 116*ms) == 0.);
+}
+
+/// The bucketed estimator counts per bucket and honours its window limit
+static void CheckBucketedEstimator()
+{
+  std::printf("Bucketed estimator\n");
+  BasicBucketedFPSEstimator<ManualClock> estimator;
+  ManualClock::now = START;
+  estimator.AddSample();
+  ManualClock::now += 500000000;
+  CHECK(estimator.FPS(1.f) < 0.f);
+  for (int i = 0; i < 2000; ++i) {
+    ManualClock::now = START + 500000000 + i*1000000LL;
+    estimator.AddSample();
+  }
+  CHECK(Near(estimator.FPS(1.f), 1000., 1e-3));
+  CHECK(Near(estimator.FPS(2.f), 1000., 1e-3));
+  /// Longer than the 10 s given at construction
+  CHECK(estimator.FPS(20.f) < 0.f);
+
+  /// Buckets that rolled out of the window no longer count
+  ManualClock::now += 2000000000;
+  CHECK(estimator.FPS(1.f) == 0.f);
+}
+
+/// Shards add up to the total, also with more threads than shards
+static void CheckShardedEstimator()
+{
+  std::printf("Sharded estimator\n");
+  const unsigned int threads = 8;
+  const int per_thread = 10000;
+  BasicShardedFPSEstimator<ManualClock> estimator(4);
+  CHECK(estimator.Shards() == 4);
+  ManualClock::now = START;
+  estimator.AddSample();
+  ManualClock::now += 1000000000;
+  RunThreads(threads, [&](unsigned int) {
+    for (int i = 0; i < per_thread; ++i)
+      estimator.AddSample();
+  });
+  ManualClock::now += 1000000;
+  CHECK(Near(estimator.FPS(0.5f), threads*per_thread/0.5, 1e-6));
+  CHECK(Near(estimator.FPS(1.f), threads*per_thread/1., 1e-6));
+  CHECK(estimator.FPS(2.f) < 0.f);
+}
+
+/// fps.h can be included by several translation units
+static void CheckLinkage()
+{
+  std::printf("Linkage\n");
+  CHECK(OtherTranslationUnitFPS() < 0.f);
+}
+
+/// Concurrent producers lose no samples
+static void CheckConcurrentProducers()
+{
+  std::printf("Concurrent producers\n");
+  const unsigned int threads = 8;
+  const int per_thread = 4000;
+  BasicFPSEstimator<ManualClock> estimator(65536);
+  /// Two samples before the window, so that it counts as filled
+  ManualClock::now = START;
+  estimator.AddSample();
+  estimator.AddSample();
+  ManualClock::now += 1000000000;
+  RunThreads(threads, [&](unsigned int) {
+    for (int i = 0; i < per_thread; ++i)
+      estimator.AddSample();
+  });
+  ManualClock::now += 1000000;
+  CHECK(estimator.FPS(0.5f) == threads*per_thread/0.5f);
+}
+
+
+/// Readers see a growing, never torn, window while producers add to it
+static void CheckConcurrentReaders()
+{
+  std::printf("Concurrent readers\n");
+  const unsigned int producers = 4;
+  const unsigned int readers = 2;
+  const int per_thread = 20000;
+  const float most = producers*per_thread/0.5f;
+  BasicFPSEstimator<ManualClock> estimator(131072);
+  ManualClock::now = START;
+  estimator.AddSample();
+  estimator.AddSample();
+  ManualClock::now += 1000000000;
+  std::atomic<unsigned int> running(producers);
+  std::atomic<int> bad_reads(0);
+  RunThreads(producers+readers, [&](unsigned int index) {
+    if (index < producers) {
+      for (int i = 0; i < per_thread; ++i)
+        estimator.AddSample();
+      running.fetch_sub(1);
+      return;
+    }
+    float previous = 0.f;
+    while (running.load() > 0) {
+      const float fps = estimator.FPS(0.5f);
+      if (fps < previous || fps > most)
+        bad_reads.fetch_add(1);
+      previous = fps;
+    }
+  });
+  CHECK(bad_reads.load() == 0);
+  CHECK(estimator.FPS(0.5f) == most);
+}
+
+/// Batches larger than the ring, and many samples at one time point
+static void CheckBatches()
+{
+  std::printf("Batches\n");
+  BasicFPSEstimator<ManualClock> estimator(16);
+  ManualClock::now = START + 1000000000;
+  /// A batch larger than the ring keeps its newest samples
+  std::vector<TIME_POINT_T> batch(100);
+  for (std::size_t i = 0; i < batch.size(); ++i)
+    batch[i] = ManualClock::At(START + static_cast<int64_t>(i)*10000000);
+  estimator.AddSamples(batch.data(), batch.data()+batch.size());
+  CHECK(Near(estimator.FPS(0.1f), 100., 0.11));
+  CHECK(estimator.FPS(0.5f) < 0.f);
+
+  /// "count" samples at one time point; the window is only known to be
+  /// filled while some retained sample predates it
+  BasicFPSEstimator<ManualClock> same(16);
+  ManualClock::now = START;
+  same.AddSamples(2, ManualClock::Now());
+  ManualClock::now += 500000000;
+  same.AddSamples(10, ManualClock::Now());
+  CHECK(Near(same.FPS(0.4f), 10./0.4, 1e-3));
+  same.AddSamples(1000, ManualClock::Now());
+  CHECK(same.FPS(0.4f) < 0.f);
+}
+
+/// Samples too old for the wheel are dropped, not miscounted
+static void CheckTooOldSamples()
+{
+  std::printf("Too old samples\n");
+  BasicBucketedFPSEstimator<ManualClock> estimator(
+      std::chrono::milliseconds(1), 1.f);
+  ManualClock::now = START;
+  for (int i = 0; i < 4000; ++i)
+    estimator.AddSample(ManualClock::At(START - 2000000000 + i*500000));
+  const float before = estimator.FPS(0.5f);
+  CHECK(Near(before, 2000., 0.01));
+
+  std::vector<TIME_POINT_T> old(100, ManualClock::At(START - 1026000000));
+  estimator.AddSamples(old.data(), old.data()+old.size());
+  estimator.AddSamples(50, ManualClock::At(START - 1025000000));
+  CHECK(estimator.FPS(0.5f) == before);
+}
+
+/**
+ * Feed 1000/s for eleven seconds, so that every slot of the (10 s) wheel
+ * holds a count, then check the rate over the past second
+ */
+template <typename EstimatorT>
+static bool CountsAfterIdleGap(EstimatorT& estimator, int64_t gap)
+{
+  const int64_t begin = ManualClock::now + gap;
+  for (int i = 0; i < 11000; ++i) {
+    ManualClock::now = begin + i*1000000LL;
+    estimator.AddSample();
+  }
+  return Near(estimator.FPS(1.f), 1000., 1e-3);
+}
+
+/// Wheels keep counting after idle gaps longer than 2^31 buckets
+static void CheckIdleGap()
+{
+  std::printf("Idle gap\n");
+  const int64_t month = 30*24*3600*1000000000LL;
+  ManualClock::now = START;
+  BasicBucketedFPSEstimator<ManualClock> bucketed;
+  CHECK(CountsAfterIdleGap(bucketed, 0));
+  CHECK(CountsAfterIdleGap(bucketed, month));
+  CHECK(CountsAfterIdleGap(bucketed, 3*month));
+
+  ManualClock::now = START;
+  BasicShardedFPSEstimator<ManualClock> sharded(2);
+  CHECK(CountsAfterIdleGap(sharded, 0));
+  CHECK(CountsAfterIdleGap(sharded, month));
+}
+/// Compaction keeps the retention window answerable and drops the rest
+static void CheckRetention()
+{
+  std::printf("Retention\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  estimator.SetRetention(1.f);
+  int unanswered = 0;
+  for (int i = 0; i < 1000; ++i) {
+    ManualClock::now = START + i*10000000LL;
+    estimator.AddSample();
+    if (i <= 100)
+      continue;
+    if (estimator.FPS(1.f) < 0.f ||
+        estimator.FPS(1.f, false, FPSEstimator::AverageIntervals) < 0.f)
+      ++unanswered;
+  }
+  CHECK(unanswered == 0);
+  CHECK(Near(estimator.FPS(1.f), 100., 0.011));
+  CHECK(estimator.FPS(2.f) < 0.f);
+}
+
+/// One multi-window FPS() call agrees with single-window calls
+static void CheckMultiWindow()
+{
+  std::printf("Multi-window FPS()\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  /// 100/s with a burst at the end
+  for (int i = 0; i < 1000; ++i) {
+    ManualClock::now = START + i*10000000LL;
+    estimator.AddSample();
+  }
+  for (int i = 0; i < 50; ++i)
+    estimator.AddSample();
+  ManualClock::now += 5000000;
+
+  const float windows[] = {0.05f, 0.5f, 2.f, 9.f, 20.f};
+  const std::size_t count = sizeof(windows)/sizeof(windows[0]);
+  const FPSEstimator::EstimationMethod methods[] = {
+      FPSEstimator::CountSamples, FPSEstimator::AverageIntervals};
+  for (std::size_t m = 0; m < 2; ++m) {
+    float results[count];
+    estimator.FPS(windows, windows+count, results, methods[m]);
+    for (std::size_t w = 0; w < count; ++w) {
+      const float single = estimator.FPS(windows[w], false, methods[m]);
+      CHECK(results[w] == single);
+    }
+  }
+  CHECK(estimator.FPS(20.f) < 0.f);
+  CHECK(Near(estimator.FPS(2.f), 100.f + 50.f/2.f, 0.01));
+}
+
+/// A steady stream stays steady across rollup levels and window lengths
+static void CheckRollups()
+{
+  std::printf("Rollups\n");
+  BasicFPSEstimator<ManualClock> estimator(16);
+  estimator.EnableRollups();
+  const float windows[] = {30.f, 119.f, 130.f, 600.f, 7200.f, 7300.f};
+  double worst = 0.;
+  for (int64_t i = 0; i <= 74000; ++i) {
+    ManualClock::now = START + i*100000000LL;
+    estimator.AddSample();
+    if (i % 100 != 0)
+      continue;
+    for (std::size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); ++w) {
+      if (windows[w] > i/10.)
+        continue;
+      const double error =
+          std::fabs(estimator.RollupFPS(windows[w]) - 10.) / 10.;
+      if (error > worst)
+        worst = error;
+    }
+  }
+  CHECK(worst < 0.01);
+  CHECK(estimator.RollupFPS(1e6f) < 0.f);
+}
+
+/// Frame time percentiles and "1% low" FPS
+static void CheckPercentiles()
+{
+  std::printf("Interval percentiles\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  estimator.EnableIntervalHistogram();
+  /// 60 fps with every 100th frame taking 50 ms
+  ManualClock::now = START;
+  for (int i = 0; i < 500; ++i) {
+    ManualClock::now += (i % 100 == 99) ? 50000000 : 16666667;
+    estimator.AddSample();
+  }
+  const float quantiles[] = {0.5f, 0.98f, 0.999f};
+  float results[3];
+  estimator.IntervalPercentiles(9.f, quantiles, quantiles+3, results);
+  CHECK(Near(results[0], 0.016667, 0.07));
+  CHECK(Near(results[1], 0.016667, 0.07));
+  CHECK(Near(results[2], 0.05, 0.07));
+  CHECK(Near(estimator.LowFPS(9.f, 0.01f), 20., 0.07));
+}
+
+/// Every interval falls into the bucket whose range contains it
+static void CheckHistogramBuckets()
+{
+  std::printf("Histogram buckets\n");
+  int misplaced = 0;
+  for (int64_t interval = 1; interval < (int64_t(1) << 40);
+       interval += interval/7 + 1) {
+    const std::size_t index = IntervalHistogram::BucketIndex(interval);
+    const int64_t start = IntervalHistogram::BucketStart(index);
+    if (interval < start ||
+        interval >= start + IntervalHistogram::BucketWidth(index))
+      ++misplaced;
+  }
+  CHECK(misplaced == 0);
+}
+
+/// Merged sketches hold the combined distribution to relative accuracy
+static void CheckIntervalSketch()
+{
+  std::printf("Interval sketch\n");
+  const int64_t ms = 1000000;
+  IntervalSketch low;
+  IntervalSketch high;
+  for (int64_t i = 1; i <= 1000; ++i) {
+    low.Add(i*ms);
+    high.Add((1000+i)*ms);
+  }
+  low.Merge(high);
+  CHECK(low.Count() == 2000);
+  const double quantiles[] = {0.01, 0.25, 0.5, 0.9, 0.99};
+  for (std::size_t q = 0; q < sizeof(quantiles)/sizeof(quantiles[0]); ++q) {
+    /// Exact value: the element at rank quantile*(n-1), rounded down
+    const double exact =
+        (std::floor(quantiles[q]*1999) + 1) * 1e-3;
+    CHECK(Near(low.Quantile(quantiles[q]), exact, low.RelativeAccuracy()));
+  }
+
+  bool threw = false;
+  try {
+    low.Merge(IntervalSketch(0.05));
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  /// An estimator's sketch sees the intervals between its samples
+  BasicFPSEstimator<ManualClock> estimator;
+  estimator.EnableIntervalSketch();
+  for (int i = 0; i < 100; ++i) {
+    ManualClock::now = START + i*10*ms;
+    estimator.AddSample();
+  }
+  const IntervalSketch distribution = estimator.IntervalDistribution();
+  CHECK(distribution.Count() == 99);
+  CHECK(Near(distribution.Quantile(0.5), 0.01, 0.01));
+}
+
+/// The decaying rate tracks a steady stream and survives empty batches
+static void CheckDecayingRate()
+{
+  std::printf("Decaying rate\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  estimator.EnableDecayingRate(1.f);
+  ManualClock::now = START;
+  /// Empty batches add nothing, and must not poison the rate
+  estimator.AddSamples(0, ManualClock::Now());
+  const TIME_POINT_T none = ManualClock::Now();
+  estimator.AddSamples(&none, &none);
+  CHECK(estimator.FPS(0.5f) < 0.f);
+  for (int i = 0; i < 1000; ++i) {
+    ManualClock::now = START + i*10000000LL;
+    estimator.AddSample();
+  }
+  CHECK(Near(estimator.DecayingFPS(), 100., 0.01));
+  /// One time constant later, without samples or polling
+  ManualClock::now += 1000000000;
+  CHECK(Near(estimator.DecayingFPS(), 100./std::exp(1.), 0.01));
+  CHECK(std::isfinite(estimator.DecayingFPS()));
+}
+
+/// Throughput sums weights per second, unweighted samples weighing 1
+static void CheckThroughput()
+{
+  std::printf("Throughput\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  for (int i = 0; i < 300; ++i) {
+    ManualClock::now = START + i*10000000LL;
+    if (i % 2)
+      estimator.AddSample(1000.);
+    else
+      estimator.AddSample();
+  }
+  ManualClock::now += 5000000;
+  CHECK(Near(estimator.Throughput(1.f), 50*1000. + 50, 1e-6));
+  CHECK(Near(estimator.FPS(1.f), 100., 1e-6));
+  CHECK(estimator.Throughput(5.f) < 0.f);
+}
+
+/// Spans count completions, in-flight spans and their latencies
+template <typename EstimatorT>
+static void CheckSpansOf(EstimatorT& estimator)
+{
+  ManualClock::now = START;
+  estimator.AddSamples(2, ManualClock::Now());
+  ManualClock::now += 1000000000;
+  CHECK(estimator.SpanLatency(1.f) < 0.f);
+  estimator.EnableSpanLatency();
+  std::vector<SpanToken> tokens;
+  for (int i = 0; i < 100; ++i)
+    tokens.push_back(estimator.BeginSpan());
+  CHECK(estimator.InFlight() == 100);
+  ManualClock::now += 20000000;
+  for (int i = 0; i < 50; ++i)
+    estimator.EndSpan(tokens[i]);
+  CHECK(estimator.InFlight() == 50);
+  ManualClock::now += 20000000;
+  for (int i = 50; i < 100; ++i)
+    estimator.EndSpan(tokens[i]);
+  CHECK(estimator.InFlight() == 0);
+
+  CHECK(Near(estimator.FPS(0.5f), 100/0.5, 1e-3));
+  CHECK(Near(estimator.SpanLatency(1.f, 0.25f), 0.02, 0.07));
+  CHECK(Near(estimator.SpanLatency(1.f, 0.9f), 0.04, 0.07));
+}
+
+static void CheckSpans()
+{
+  std::printf("Spans\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  CheckSpansOf(estimator);
+  BasicBucketedFPSEstimator<ManualClock> bucketed;
+  CheckSpansOf(bucketed);
+  BasicShardedFPSEstimator<ManualClock> sharded(2);
+  CheckSpansOf(sharded);
+}
+
+/// Hitches are flagged, reported to the callback and kept in a ring
+static void CheckHitches()
+{
+  std::printf("Hitches\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  std::vector<int64_t> reported;
+  estimator.EnableHitchDetection(3.f, 0.f, 4, [&](const Hitch& hitch) {
+    reported.push_back(TicksSinceEpoch(hitch.when));
+  });
+  /// 60 fps with a 100 ms stall every 50th frame
+  std::vector<int64_t> stalls;
+  ManualClock::now = START;
+  for (int i = 1; i <= 500; ++i) {
+    const bool stall = (i % 50 == 0);
+    ManualClock::now += stall ? 100000000 : 16666667;
+    if (stall)
+      stalls.push_back(ManualClock::now);
+    estimator.AddSample();
+  }
+  CHECK(reported == stalls);
+
+  std::vector<Hitch> hitches;
+  CHECK(estimator.Hitches(hitches) == stalls.size());
+  CHECK(hitches.size() == 4);
+  for (std::size_t i = 0; i < hitches.size(); ++i) {
+    const Hitch& hitch = hitches[i];
+    CHECK(TicksSinceEpoch(hitch.when) == stalls[stalls.size()-4+i]);
+    CHECK(Near(hitch.interval_seconds, 0.1, 1e-6));
+    CHECK(Near(hitch.median_seconds, 0.016667, 0.05));
+  }
+
+  /// An absolute budget flags long intervals without a median
+  HitchDetector budget(0.f, 0.03f, 4, HitchDetector::Callback());
+  CHECK(!budget.Add(START, 20000000));
+  CHECK(budget.Add(START, 40000000));
+  CHECK(budget.Count() == 1);
+}
+
+/// Change detection on batched samples
+static void CheckRateChanges()
+{
+  std::printf("Rate change detection\n");
+  BasicFPSEstimator<ManualClock> estimator;
+  estimator.EnableRateChangeDetection();
+  RateChange change;
+  ManualClock::now = START;
+  for (int i = 0; i < 2000; ++i) {
+    ManualClock::now += 10000000;
+    estimator.AddSamples(64, ManualClock::Now());
+  }
+  CHECK(estimator.LastRateChange(change) == 0);
+
+  for (int i = 0; i < 300; ++i) {
+    ManualClock::now += 10000000;
+    estimator.AddSamples(128, ManualClock::Now());
+  }
+  CHECK(estimator.LastRateChange(change) == 1);
+  CHECK(Near(change.rate_before, 6400., 0.05));
+  CHECK(Near(change.rate_after, 12800., 0.1));
+
+  /// Single samples: 100/s, then 200/s from "jump" on
+  BasicFPSEstimator<ManualClock> single;
+  single.EnableRateChangeDetection();
+  ManualClock::now = START;
+  for (int i = 0; i < 1000; ++i) {
+    ManualClock::now += 10000000;
+    single.AddSample();
+  }
+  const int64_t jump = ManualClock::now;
+  for (int i = 0; i < 200; ++i) {
+    ManualClock::now += 5000000;
+    single.AddSample();
+  }
+  CHECK(single.LastRateChange(change) == 1);
+  CHECK(Near(change.rate_before, 100., 0.05));
+  CHECK(Near(change.rate_after, 200., 0.1));
+  CHECK(std::llabs(TicksSinceEpoch(change.when) - jump) <= 100000000);
+  CHECK(TicksSinceEpoch(change.detected) - jump <= 500000000);
+}
+
+/// The compact estimator stays small and tracks the decaying rate
+static void CheckCompactEstimator()
+{
+  std::printf("Compact estimator\n");
+  CHECK(sizeof(BasicCompactFPSEstimator<ManualClock>) <= 32);
+  BasicCompactFPSEstimator<ManualClock> estimator(1.f);
+  ManualClock::now = START;
+  CHECK(estimator.FPS() < 0.f);
+  for (int i = 0; i < 1000; ++i) {
+    ManualClock::now = START + i*10000000LL;
+    estimator.AddSample();
+  }
+  CHECK(estimator.Count() == 1000);
+  CHECK(TicksSinceEpoch(estimator.LastSample()) == ManualClock::now);
+  CHECK(Near(estimator.FPS(), 100., 0.01));
+  ManualClock::now += 1000000000;
+  CHECK(Near(estimator.FPS(), 100./std::exp(1.), 0.01));
+
+  /// Concurrent samples at one time point all count
+  estimator.Reset();
+  CHECK(estimator.FPS() < 0.f);
+  RunThreads(8, [&](unsigned int) {
+    for (int i = 0; i < 10000; ++i)
+      estimator.AddSample();
+  });
+  CHECK(estimator.Count() == 80000);
+  CHECK(Near(estimator.FPS(), 80000., 1e-4));
+}
+
+/// Names are interned once; handles index the registered estimators
+static void CheckRegistry()
+{
+  std::printf("Registry\n");
+  BasicFPSRegistry<BasicBucketedFPSEstimator<ManualClock> > registry(3);
+  const unsigned int threads = 4;
+  std::vector<uint32_t> handles(threads);
+  RunThreads(threads, [&](unsigned int index) {
+    handles[index] = registry.Register("requests");
+  });
+  for (unsigned int t = 0; t < threads; ++t)
+    CHECK(handles[t] == handles[0]);
+  const uint32_t requests = handles[0];
+  const uint32_t errors = registry.Register("errors");
+  CHECK(registry.Size() == 2);
+  CHECK(registry.Find("errors") == errors);
+  CHECK(registry.Find("unknown") == registry.INVALID_HANDLE);
+  CHECK(registry.Name(requests) == "requests");
+
+  registry.Register("timeouts");
+  bool threw = false;
+  try {
+    registry.Register("retries");
+  } catch (const std::length_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  for (int i = 0; i < 2000; ++i) {
+    ManualClock::now = START + i*1000000LL;
+    registry.AddSample(requests);
+    if (i % 4 == 0)
+      registry.AddSample(errors, ManualClock::Now());
+  }
+  std::vector<float> rates;
+  registry.Snapshot(1.f, rates);
+  CHECK(rates.size() == 3);
+  CHECK(Near(rates[requests], 1000., 1e-3));
+  CHECK(Near(rates[errors], 250., 1e-3));
+  CHECK(rates[registry.Find("timeouts")] < 0.f);
+  CHECK(rates[requests] == registry[requests].FPS(1.f));
+}
+
+/// TopK() finds the busiest keys among many rare ones
+static void CheckTopK()
+{
+  std::printf("Top-K keys\n");
+  BasicKeyedFPSEstimator<ManualClock> estimator(5);
+  /// Keys 1..20 at 20/s times the key, plus 5000 one-off keys per second
+  std::vector<double> owed(21, 0.);
+  uint64_t rare_key = 1000;
+  for (int t = 0; t < 3000; ++t) {
+    ManualClock::now = START + t*1000000LL;
+    for (int key = 1; key <= 20; ++key) {
+      for (owed[key] += key*0.02; owed[key] >= 1.; owed[key] -= 1.)
+        estimator.AddSample(key);
+    }
+    for (int i = 0; i < 5; ++i)
+      estimator.AddSample(rare_key++);
+  }
+
+  std::vector<std::pair<uint64_t, float> > top;
+  estimator.TopK(1.f, top);
+  CHECK(top.size() == 5);
+  for (std::size_t i = 0; i < top.size(); ++i) {
+    const uint64_t key = 20-i;
+    CHECK(top[i].first == key);
+    /// Count-Min estimates never undercount
+    CHECK(top[i].second >= 20.f*key - 1.f);
+    CHECK(top[i].second <= 20.f*key*1.05f + 10.f);
+  }
+  CHECK(estimator.FPS(3) >= 60.f - 1.f);
+  CHECK(estimator.FPS(20, 20.f) < 0.f);
+}
+
+/// Distinct() stays within a few standard errors and ignores repeats
+static void CheckDistinct()
+{
+  std::printf("Distinct keys\n");
+  BasicDistinctFPSEstimator<ManualClock> estimator;
+  /// The same 20000 keys every second, 20 per millisecond
+  const int keys = 20000;
+  int next = 0;
+  for (int t = 0; t < 4000; ++t) {
+    ManualClock::now = START + t*1000000LL;
+    for (int i = 0; i < 20; ++i) {
+      estimator.AddSample(next);
+      next = (next+1) % keys;
+    }
+  }
+
+  /// 1.04/sqrt(4096) is ~1.6%; allow four standard errors
+  for (float window = 1.f; window <= 3.f; window += 1.f) {
+    CHECK(Near(estimator.Distinct(window), keys, 0.065f));
+    CHECK(Near(estimator.FPS(window), 20000.f, 0.01f));
+  }
+  CHECK(estimator.Distinct(5.f) < 0.f);
+  CHECK(estimator.Distinct(20.f) < 0.f);
+
+  /// Small counts use linear counting and are close to exact
+  estimator.Reset();
+  for (int t = 0; t < 2000; ++t) {
+    ManualClock::now = START + t*1000000LL;
+    estimator.AddSample(t % 50);
+  }
+  CHECK(Near(estimator.Distinct(1.f), 50.f, 0.05f));
+}
+
+/// Rates() agrees with FPS(), also while threads cross bucket boundaries
+static void CheckBank()
+{
+  std::printf("Estimator bank\n");
+  const std::size_t counters = 37;
+  BasicFPSEstimatorBank<ManualClock> bank(counters);
+  /// Counter c gets c+1 samples every 10 ms
+  for (int t = 0; t < 3000; t += 10) {
+    ManualClock::now = START + t*1000000LL;
+    for (std::size_t c = 0; c < counters; ++c)
+      bank.AddSamples(c, c+1, ManualClock::Now());
+  }
+  ManualClock::now = START + 3000*1000000LL;
+  std::vector<float> rates;
+  bank.Rates(2.f, rates);
+  CHECK(rates.size() == counters);
+  for (std::size_t c = 0; c < counters; ++c) {
+    CHECK(Near(rates[c], 100.f*(c+1), 0.001f));
+    CHECK(Near(bank.FPS(c, 2.f), rates[c], 0.001f));
+  }
+  /// Half of the oldest bucket is in the window: (5 + 10 + 0) / 0.2 s
+  ManualClock::now = START + 3050*1000000LL;
+  bank.Rates(0.2f, rates);
+  CHECK(Near(rates[0], 75.f, 0.001f));
+  CHECK(Near(bank.FPS(0, 0.2f), 75.f, 0.001f));
+  /// Only the newest bucket, of which 75% is in the window
+  ManualClock::now = START + 2975*1000000LL;
+  bank.Rates(0.05f, rates);
+  CHECK(Near(rates[1], 300.f, 0.001f));
+  CHECK(Near(bank.FPS(1, 0.05f), 300.f, 0.001f));
+  bank.Rates(20.f, rates);
+  CHECK(rates[0] < 0.f);
+
+  /// Unsynchronized producers, each a little behind or ahead of the others
+  bank.Reset();
+  const unsigned int threads = 4;
+  RunThreads(threads, [&](unsigned int index) {
+    for (int t = 0; t < 3000; ++t) {
+      const TIME_POINT_T when = ManualClock::At(START + t*1000000LL);
+      bank.AddSample(index, when);
+      bank.AddSample(counters-1, when);
+    }
+  });
+  ManualClock::now = START + 3000*1000000LL;
+  bank.Rates(2.f, rates);
+  for (unsigned int t = 0; t < threads; ++t)
+    CHECK(Near(rates[t], 1000.f, 0.001f));
+  CHECK(Near(rates[counters-1], 1000.f*threads, 0.001f));
+  CHECK(Near(bank.FPS(counters-1, 2.f), rates[counters-1], 0.001f));
+}
+
+/// A parent's FPS() includes all its descendants; cycles are refused
+static void CheckEstimatorTree()
+{
+  std::printf("Estimator tree\n");
+  typedef BasicBucketedFPSEstimator<ManualClock> Estimator;
+  Estimator global, service, login, logout;
+  service.AddChild(&login);
+  service.AddChild(&logout);
+  /// Adding a child twice does not count it twice
+  service.AddChild(&logout);
+  global.AddChild(&service);
+
+  /// 1000/s on login, 200/s on logout, 100/s on the service, 10/s global
+  for (int t = 0; t < 3000; ++t) {
+    ManualClock::now = START + t*1000000LL;
+    login.AddSample();
+    if (t % 5 == 0)
+      logout.AddSample();
+    if (t % 10 == 0)
+      service.AddSample();
+    if (t % 100 == 0)
+      global.AddSample();
+  }
+  ManualClock::now = START + 3000*1000000LL;
+  CHECK(Near(login.FPS(2.f), 1000.f, 1e-3));
+  CHECK(Near(logout.FPS(2.f), 200.f, 1e-3));
+  CHECK(Near(service.FPS(2.f), 1300.f, 1e-3));
+  CHECK(Near(global.FPS(2.f), 1310.f, 1e-3));
+
+  service.RemoveChild(&logout);
+  CHECK(Near(service.FPS(2.f), 1100.f, 1e-3));
+  CHECK(Near(global.FPS(2.f), 1110.f, 1e-3));
+  CHECK(Near(logout.FPS(2.f), 200.f, 1e-3));
+
+  int refused = 0;
+  Estimator* cycles[] = { &global, &service };
+  for (Estimator* ancestor : cycles) {
+    try {
+      login.AddChild(ancestor);
+    } catch (const std::invalid_argument&) {
+      ++refused;
+    }
+  }
+  try {
+    global.AddChild(&global);
+  } catch (const std::invalid_argument&) {
+    ++refused;
+  }
+  CHECK(refused == 3);
+  CHECK(Near(global.FPS(2.f), 1110.f, 1e-3));
+
+  /// Of two threads linking a pair both ways, exactly one succeeds
+  for (int round = 0; round < 100; ++round) {
+    Estimator first, second;
+    Estimator* pair[] = { &first, &second };
+    std::atomic<int> failures(0);
+    RunThreads(2, [&](unsigned int index) {
+      try {
+        pair[index]->AddChild(pair[1-index]);
+      } catch (const std::invalid_argument&) {
+        ++failures;
+      }
+    });
+    CHECK(failures == 1);
+    first.RemoveChild(&second);
+    second.RemoveChild(&first);
+  }
+}
+
+
+
+int main(int argc, char** argv) {
+
+  (void)argc;
+  (void)argv;
+
+  CheckRingWrapAround();
+  CheckCounterWheel();
+  CheckBucketedEstimator();
+  CheckShardedEstimator();
+  CheckLinkage();
+  CheckConcurrentProducers();
+  CheckConcurrentReaders();
+  CheckBatches();
+  CheckTooOldSamples();
+  CheckIdleGap();
+  CheckRetention();
+  CheckMultiWindow();
+  CheckRollups();
+  CheckPercentiles();
+  CheckHistogramBuckets();
+  CheckIntervalSketch();
+  CheckDecayingRate();
+  CheckThroughput();
+  CheckSpans();
+  CheckHitches();
+  CheckRateChanges();
+  CheckCompactEstimator();
+  CheckRegistry();
+  CheckTopK();
+  CheckDistinct();
+  CheckBank();
+  CheckEstimatorTree();
+
+  if (g_failures > 0) {
+    std::printf("%d check(s) failed\n", g_failures.load());
+    return EXIT_FAILURE;
+  }
+  std::printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,26 @@
+
+/// Local files
+#include "fps.h"
+
+
+using namespace FramesPerSecond;
+
+
+/**
+ * A second translation unit including fps.h, so that the checks fail
+ * to link if the header defines anything non-inline. Touches the
+ * components that are defined outside their class bodies.
+ */
+float OtherTranslationUnitFPS()
+{
+  FPSEstimator estimator(16);
+  estimator.EnableRollups();
+  estimator.EnableIntervalHistogram();
+  estimator.EnableIntervalSketch();
+  estimator.EnableDecayingRate();
+  estimator.EnableHitchDetection();
+  estimator.EnableRateChangeDetection();
+  BucketedFPSEstimator bucketed;
+  return estimator.FPS() + bucketed.FPS();
+}
+
@@ -28,6 +28,11 @@
  * > }
  * >
  *
+ * FPSEstimator keeps a fixed number of samples (65536 by default, see
+ * its constructor); FPS() returns -1 for windows that would need more.
+ * Pass a larger capacity for long windows at high rates, or use
+ * BucketedFPSEstimator, whose memory does not depend on the rate.
+ *
  * ====================================================================
  */
 
@@ -48,10 +53,28 @@
   #include <iostream>
   #include <sstream>
 #endif
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#ifdef THREAD_SAFE
-  #include <mutex>
+#if defined(__linux__)
+  #include <time.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <cpuid.h>
+  #include <x86intrin.h>
+  #define FRAMESPERSECOND_HAVE_TSC
 #endif
 
 
@@ -61,345 +84,5208 @@ namespace FramesPerSecond {
   typedef std::chrono::duration<TIME_POINT_T> TIME_DURATION_T;
   typedef std::chrono::nanoseconds TIME_RESOLUTION_T;
 
+  /// Assumed size of a cache line, used to keep hot data apart
+  static const std::size_t CACHE_LINE_BYTES = 64;
+
 
   /// /////////////////////////////////////////////////////////////////
   /// Non-class functions
   /// /////////////////////////////////////////////////////////////////
     
-  /// Get current time point
-  static TIME_POINT_T Now()
+  /// Get current time point (see also the clock sources below)
+  inline TIME_POINT_T Now()
   {
     return std::chrono::steady_clock::now();
   }
   
-  /// Compute elapsed milliseconds between two time points
-  static float NanosecondsBetween(const TIME_POINT_T& end,
+  /**
+   * Compute elapsed MICROseconds between two time points. Only meant for
+   * display; float precision is poor for long time spans, so anything
+   * that compares or accumulates times works on integer ticks instead.
+   */
+  inline float NanosecondsBetween(const TIME_POINT_T& end,
                                   const TIME_POINT_T& start)
   {
     return std::chrono::duration_cast<TIME_RESOLUTION_T>(end-start).count() /
            1e3f;
   }
-  
 
+  /// Nanoseconds ("ticks") since the clock's epoch
+  inline int64_t TicksSinceEpoch(const TIME_POINT_T& time_point)
+  {
+    return std::chrono::duration_cast<TIME_RESOLUTION_T>(
+               time_point.time_since_epoch()).count();
+  }
 
+  /// Atomically lower "target" to "value" if that is smaller
+  inline void StoreMinimum(std::atomic<int64_t>& target, int64_t value)
+  {
+    int64_t current = target.load(std::memory_order_relaxed);
+    while (value < current &&
+           !target.compare_exchange_weak(current, value,
+                                         std::memory_order_relaxed)) { }
+  }
 
-  /// /////////////////////////////////////////////////////////////////
-  /// FPSEstimator class declaration
-  /// /////////////////////////////////////////////////////////////////
-  class FPSEstimator {
-    
-  public:
+  /// Integer division rounding towards negative infinity
+  inline int64_t FloorDivide(int64_t numerator, int64_t denominator)
+  {
+    const int64_t quotient = numerator / denominator;
+    return (quotient*denominator > numerator) ? quotient-1 : quotient;
+  }
 
-    enum EstimationMethod {
-      CountSamples = 0,
-      AverageIntervals
-    };
-    
-    /// Constructor
-    FPSEstimator();
-        
-    /// Destructor
-    ~FPSEstimator() { }
-    
-    /// Set decay factor
-    void SetDecayFactor(
-          float new_decay_factor = 0.f);
+  /// Publish "component" in "slot" unless another one got there first
+  template <typename T>
+  void InstallOnce(std::atomic<T*>& slot, T* component)
+  {
+    T* expected = NULL;
+    if (!slot.compare_exchange_strong(expected, component,
+                                      std::memory_order_acq_rel))
+      delete component;
+  }
 
-    /// Add a sample
-    void AddSample();    
-    
-    /** 
-     * Estimate FPS over a given window. Larger choices of the argument 
-     * "window_seconds" will lead to more stable estimates, but may smooth 
-     * out (and thus lose) high frequency changes in the FPS rate.
-     * 
-     * @param window_seconds Number of past seconds over which to measure
-     * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
-     * 
-     * @returns an estimate of the rate with which new samples are currently 
-     *          arriving, computed over a past time window of "window_seconds" 
-     *          seconds (starting now). If there is not enough data available, 
-     *          a negative value is returned.
-     */
-    float FPS(
-          float window_seconds = 1.f,
-          bool soft_estimate = false,
-          EstimationMethod method = CountSamples);
-        
-    /// Reset the instance
-    void Reset();
-    
-  private:
-    
-    
-    std::vector<TIME_POINT_T> m_sample_times;
+  /// Atomically replace "log_sum" by log(exp(log_sum) + exp(exponent))
+  inline void AddLogExp(std::atomic<double>& log_sum, double exponent)
+  {
+    double current = log_sum.load(std::memory_order_relaxed);
+    double updated;
+    do {
+      if (current > exponent)
+        updated = current + std::log1p(std::exp(exponent - current));
+      else
+        updated = exponent + std::log1p(std::exp(current - exponent));
+    } while (!log_sum.compare_exchange_weak(current, updated,
+                                            std::memory_order_relaxed));
+  }
 
-    float m_rolling;
-    float m_decay_factor;
-    
-    #ifdef DEBUG_MODE
-      TIME_POINT_T m_debug_start_time;
-    #endif
+  /// Hash a 64-bit key (SplitMix64 finalizer), "seed" selects the function
+  inline uint64_t HashKey(uint64_t key, uint64_t seed)
+  {
+    uint64_t hash = key + (seed+1) * 0x9e3779b97f4a7c15ull;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+  }
 
-    #ifdef THREAD_SAFE
-      std::mutex m_sample_times__mutex;
+  /// Number of leading zero bits of a non-zero "value"
+  inline int LeadingZeros(uint64_t value)
+  {
+    #if defined(__GNUC__)
+      return __builtin_clzll(value);
+    #else
+      int zeros = 0;
+      for (int shift = 32; shift > 0; shift /= 2) {
+        if (!(value >> (64-shift))) {
+          zeros += shift;
+          value <<= shift;
+        }
+      }
+      return zeros;
     #endif
-  };
+  }
+
+  /// Convert a duration in seconds to ticks
+  inline int64_t SecondsToTicks(float seconds)
+  {
+    return static_cast<int64_t>(static_cast<double>(seconds) * 1e9);
+  }
+  
 
 
 
   /// /////////////////////////////////////////////////////////////////
-  /// FPSEstimator class implementation
+  /// Clock sources
   /// /////////////////////////////////////////////////////////////////
-
-  /// Constructor
-  FPSEstimator::FPSEstimator()
-  : m_rolling(0.f),
-    m_decay_factor(0.f)
-  { 
-    #ifdef DEBUG_MODE
-      m_debug_start_time = Now();
-    #endif
-  }
-
   /**
-   * Set decay factor
+   * Clock policies for the estimator class templates. Each one provides a
+   * static Now() returning a TIME_POINT_T on the steady_clock time base,
+   * so the rest of the code does not care which clock took a sample.
    *
-   * @param new_decay_factor The new decay factor
+   *   Clock        Resolution               Cost of Now() (x86-64 Linux)
+   *   -----------  -----------------------  ---------------------------
+   *   SteadyClock  1 ns                     ~15-25 ns (vDSO, reads TSC)
+   *   CoarseClock  1 kernel tick (1-4 ms)   ~3-5 ns (vDSO, no TSC read)
+   *   TscClock     ~1 ns (TSC frequency)    ~6-10 ns (rdtsc + multiply)
+   *
+   * CoarseClock suits windows of a second or more, and in particular the
+   * millisecond-bucketed estimators. TscClock needs an invariant TSC; on
+   * other CPUs (and non-x86 targets) it falls back to SteadyClock.
    */
-  void FPSEstimator::SetDecayFactor(float new_decay_factor)
-  {
-    m_decay_factor = new_decay_factor;
-  }
-  
-  /// Add a sample
-  void FPSEstimator::AddSample()
-  {
-    const TIME_POINT_T now = Now();
+
+  /// std::chrono::steady_clock (the default)
+  struct SteadyClock {
+    static TIME_POINT_T Now()
     {
-      #ifdef THREAD_SAFE
-        std::lock_guard<std::mutex> lock(m_sample_times__mutex);
-      #endif
-      m_sample_times.push_back(now);
+      return std::chrono::steady_clock::now();
     }
-    
-    #ifdef DEBUG_MODE
-      float elapsed = NanosecondsBetween(now, m_debug_start_time);
-      std::cout << "FPSEstimator: New sample stored ("
-                << elapsed << "ns)\n";
-    #endif
-  }
-  
-  /** 
-   * Estimate FPS over a given window. Larger choices of the argument 
-   * "window_seconds" will lead to more stable estimates, but may smooth 
-   * out (and thus lose) high frequency changes in the FPS rate.
-   * 
-   * @param window_seconds Number of past seconds over which to measure
-   * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
-   * 
-   * @returns an estimate of the rate with which new samples are currently 
-   *          arriving, computed over a past time window of "window_seconds" 
-   *          seconds (starting now). If there is not enough data available, 
-   *          a negative value is returned.
-   */
-  float FPSEstimator::FPS(float window_seconds,
-                          bool soft_estimate,
-                          FPSEstimator::EstimationMethod method)
-  {
-    if (m_sample_times.size() <= 0)
-      return -1.f;
+  };
 
-    switch (method) {
-    
-      case CountSamples: {
-        #ifdef DEBUG_MODE
-          std::ostringstream oss;
-          oss << "FPSEstimator: Sampling.. ( ";
-        #endif
+  /// CLOCK_MONOTONIC_COARSE where available, steady_clock elsewhere
+  struct CoarseClock {
+    static TIME_POINT_T Now()
+    {
+      #if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+        /// Same time base as steady_clock (CLOCK_MONOTONIC)
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return TIME_POINT_T(std::chrono::duration_cast<TIME_POINT_T::duration>(
+                   std::chrono::seconds(ts.tv_sec) +
+                   std::chrono::nanoseconds(ts.tv_nsec)));
+      #else
+        return std::chrono::steady_clock::now();
+      #endif
+    }
+  };
 
-        float samples = 0.f;
-        int i = m_sample_times.size()-1;
-        const TIME_POINT_T now = Now();
-        {
-          #ifdef THREAD_SAFE
-            std::lock_guard<std::mutex> lock(m_sample_times__mutex);
-          #endif
-          for (; i >= 0; --i) {
-            if (NanosecondsBetween(now, m_sample_times[i]) >= (window_seconds*1e6f))
-              break;
-            #ifdef DEBUG_MODE
-              oss << NanosecondsBetween(now, m_sample_times[i]) << "ns ";
-            #endif
-            ++samples;
-          }
-        }
-        
-        #ifdef DEBUG_MODE
-          oss << ")";
-        #endif
+  /**
+   * Invariant time stamp counter, calibrated once against steady_clock.
+   * The first call to Now() (or Calibrated()) spends about 10 ms busy
+   * waiting for the calibration.
+   */
+  class TscClock {
 
-        /// If "index" is negative, there were not enough samples to fill the time window
-        if (i <= 0)
-          return -1.f;
-        
-        /** 
-         * We have an integer estimate, but we want to be more informative. 
-         * Let's compute an estimate for the mission fraction.
-         *
-         *    window_seconds*1e6-NsB(now,i+1)
-         *              ╭──┴─╮
-         *              │╭NsB(now,i)-NsB(now,i-1)           
-         *           ╭───┴───╮                              
-         *  o    o   o  [    o      o  o      o       o     ]  ◀◀ Samples
-         *  0   i-1  i  │   i+1                   size()-1  │
-         *           │  ╰────────────────┬──────────────────╯
-         *           │       │    window_seconds*1e6)       │
-         *           │       ╰────────────────┬─────────────╯
-         *           │                  NsB(now,i+1)        │
-         *           ╰────────────────────────┬─────────────╯
-         *                              NsB(now,i)
-         *
-         *  >>>>>>>>>>>>│>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>│  ◀◀ Timeline
-         *    "window_seconds" ago                         Now
-         *
-         *  Old samples (indices 0 to i-1) are periodically discarded.
-         */
-        
-        #ifdef DEBUG_MODE
-          oss << "\n";
-          std::cout << oss.str();
-        #endif
+  public:
 
-        /// Discard old samples
-        {
-          static int cleanup = 0;
-          if (++cleanup >= 1000) {
-            #ifdef DEBUG_MODE
-              oss << "\nFPSEstimator: Discarding " << (i-1) << " old samples.";
-            #endif
-            cleanup = 0;
-            {
-              #ifdef THREAD_SAFE
-                std::lock_guard<std::mutex> lock(m_sample_times__mutex);
-              #endif
-              m_sample_times.erase(m_sample_times.begin(),
-                                   m_sample_times.begin()+i-1);
-            }
-          }
+    static TIME_POINT_T Now()
+    {
+      #ifdef FRAMESPERSECOND_HAVE_TSC
+        const Calibration& calibration = GetCalibration();
+        if (calibration.valid) {
+          /// Signed, so a read from a core whose TSC lags the base stays small
+          const double elapsed = static_cast<double>(static_cast<int64_t>(
+                                     __rdtsc() - calibration.base_tsc));
+          return calibration.base_time + TIME_RESOLUTION_T(
+                     static_cast<int64_t>(elapsed * calibration.ns_per_tick));
         }
+      #endif
+      return std::chrono::steady_clock::now();
+    }
 
-        /// Adjust the rolling weighted average estimate
-        m_rolling =      m_decay_factor  * m_rolling + 
-                    (1.f-m_decay_factor) * samples/window_seconds;
-          
-        if (soft_estimate)
-          return m_rolling;
-        else
-          return samples/window_seconds;
-      }
+    /// IFF FALSE, Now() falls back to steady_clock
+    static bool Calibrated()
+    {
+      return GetCalibration().valid;
+    }
 
-      case AverageIntervals: {
-        int samples = 0;
-        int i = m_sample_times.size()-1;
-        const TIME_POINT_T now = Now();
-        TIME_POINT_T youngest_sample;
-        
-        #ifdef DEBUG_MODE
-          std::ostringstream oss;
-          oss << "FPSEstimator: Passing samples: (";
-        #endif
-          
-        {
-          #ifdef THREAD_SAFE
-            std::lock_guard<std::mutex> lock(m_sample_times__mutex);
-          #endif
-          youngest_sample = m_sample_times[i];
-          for (; i >= 0; --i) {
-            if (NanosecondsBetween(now, m_sample_times[i]) >= (window_seconds*1e6f))
-              break;
-            #ifdef DEBUG_MODE
-              oss << NanosecondsBetween(now, m_sample_times[i]) << "ns ";
-            #endif
-            ++samples;
-          }
-        }
-        
-        #ifdef DEBUG_MODE
-          oss << ") = " << samples << " samples, youngest sample="
-              << NanosecondsBetween(now, youngest_sample)
-              << "ns\n";
-        #endif
+  private:
 
-        /// If "index" is negative, there were not enough samples to fill the time window
-        if (i < 0)
-          return -1.f;
+    struct Calibration {
+      bool valid;
+      uint64_t base_tsc;
+      TIME_POINT_T base_time;
+      double ns_per_tick;
+    };
 
-        float average_interval = NanosecondsBetween(youngest_sample, 
-                                                     m_sample_times[i]) /
-                                 samples;
-        float fps_estimate = 1e6f / average_interval;
+    static const Calibration& GetCalibration()
+    {
+      static const Calibration calibration = Calibrate();
+      return calibration;
+    }
 
-        #ifdef DEBUG_MODE
-          oss << "Interval=" << NanosecondsBetween(now, m_sample_times[i])
-              << "ns => " << NanosecondsBetween(now, youngest_sample)
-              << "ns is " << NanosecondsBetween(youngest_sample, 
-                                                m_sample_times[i])
-              << "ns => average over " << samples << " intervals is "
-              << average_interval << "ns\n";
-        #endif
-        
-        /// Discard old samples
-        {
-          static int cleanup = 0;
-          if (++cleanup >= 1000) {
-            #ifdef DEBUG_MODE
-              oss << "FPSEstimator: Discarding " << (i-1) << " old samples.\n";
-            #endif
-            cleanup = 0;
-            {
-              #ifdef THREAD_SAFE
-                std::lock_guard<std::mutex> lock(m_sample_times__mutex);
-              #endif
-              m_sample_times.erase(m_sample_times.begin(),
-                                   m_sample_times.begin()+i-1);
-            }
-          }
-        }
-        
-        #ifdef DEBUG_MODE
-          std::cout << oss.str();
-        #endif
+    static Calibration Calibrate()
+    {
+      Calibration calibration;
+      calibration.valid = false;
+      calibration.base_tsc = 0;
+      calibration.base_time = std::chrono::steady_clock::now();
+      calibration.ns_per_tick = 0.;
+      #ifdef FRAMESPERSECOND_HAVE_TSC
+        /// CPUID leaf 0x80000007, EDX bit 8: invariant TSC
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+            !(edx & (1u << 8)))
+          return calibration;
 
-        /// Adjust the rolling weighted average estimate
-        m_rolling =      m_decay_factor  * m_rolling + 
-                    (1.f-m_decay_factor) * fps_estimate;
-          
-        if (soft_estimate)
-          return m_rolling;
-        else
-          return fps_estimate;
-      }
+        const TIME_POINT_T start_time = std::chrono::steady_clock::now();
+        const uint64_t start_tsc = __rdtsc();
+        TIME_POINT_T end_time;
+        do {
+          end_time = std::chrono::steady_clock::now();
+        } while (end_time - start_time < std::chrono::milliseconds(10));
+        const uint64_t end_tsc = __rdtsc();
 
-      default: {
-        throw std::runtime_error("FPSEstimator: Unknown value for 'method'");
-      }
+        calibration.base_tsc = end_tsc;
+        calibration.base_time = end_time;
+        calibration.ns_per_tick =
+            static_cast<double>(TicksSinceEpoch(end_time) -
+                                TicksSinceEpoch(start_time)) /
+            static_cast<double>(end_tsc - start_tsc);
+        calibration.valid = true;
+      #endif
+      return calibration;
     }
-  }
-  
-  /// Reset the instance
-  void FPSEstimator::Reset()
-  {
-    m_sample_times.clear();
-    
-    #ifdef DEBUG_MODE
-      std::cout << "FPSEstimator: Resetting..\n";
-      m_debug_start_time = Now();
-    #endif
-  }
+  };
 
-  
-}  // namespace FramesPerSecond
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// SampleRing class (fixed-capacity, multi-producer sample storage)
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Circular buffer of sample time points with a capacity that is fixed
+   * at construction time (rounded up to the next power of two). Once the
+   * buffer is full, every new sample overwrites the oldest one; there is
+   * no reallocation after construction.
+   *
+   * Every stored sample gets a "ticket", a running index handed out by an
+   * atomic counter. Producers are wait-free: Push() claims a ticket with
+   * a single fetch_add and publishes the slot through a per-slot sequence
+   * number (a tiny seqlock). Readers address samples by ticket; Read()
+   * fails for slots that are still being written or that have since been
+   * overwritten by a newer ticket.
+   *
+   * A producer that stalls for an entire lap of the ring while another
+   * producer reuses its slot may lose its sample; the slot itself never
+   * becomes inconsistent.
+   */
+  class SampleRing {
+
+  public:
+
+    /// Constructor
+    explicit SampleRing(std::size_t capacity);
+
+    ~SampleRing() { delete[] m_weights.load(); }
+
+    /// Store a sample, evicting the oldest one if the buffer is full
+    void Push(const TIME_POINT_T& sample)
+    {
+      Store(Claim(1), TicksSinceEpoch(sample));
+    }
+
+    /// Store a batch of samples, claiming all their tickets at once
+    void Push(const TIME_POINT_T* begin, const TIME_POINT_T* end)
+    {
+      const std::size_t count = end-begin;
+      if (count == 0)
+        return;
+      uint64_t ticket = Claim(count);
+      /// Only the newest Capacity() samples can survive anyway
+      if (count > m_slots.size()) {
+        ticket += count-m_slots.size();
+        begin += count-m_slots.size();
+      }
+      for (; begin != end; ++begin, ++ticket)
+        Store(ticket, TicksSinceEpoch(*begin));
+    }
+
+    /**
+     * Store a sample carrying a weight (e.g. a byte count). The weight
+     * array is allocated on first use; until then every sample weighs 1.
+     */
+    void Push(const TIME_POINT_T& sample, double weight)
+    {
+      if (!m_weights.load(std::memory_order_acquire))
+        AllocateWeights();
+      Store(Claim(1), TicksSinceEpoch(sample), weight);
+    }
+
+    /// Store "count" samples with the same time point
+    void Push(std::size_t count, const TIME_POINT_T& sample)
+    {
+      if (count == 0)
+        return;
+      const int64_t ticks = TicksSinceEpoch(sample);
+      uint64_t ticket = Claim(count);
+      if (count > m_slots.size()) {
+        ticket += count-m_slots.size();
+        count = m_slots.size();
+      }
+      for (; count > 0; --count, ++ticket)
+        Store(ticket, ticks);
+    }
+
+    /**
+     * Read the sample with the given ticket
+     *
+     * @returns FALSE if that sample is not (or no longer) available
+     */
+    bool Read(uint64_t ticket, int64_t& sample_ticks) const
+    {
+      const Slot& slot = m_slots[ticket & m_mask];
+      const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+      if (before != 2*ticket+2)
+        return false;
+      const int64_t ticks = slot.ticks.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != before)
+        return false;
+      sample_ticks = ticks;
+      return true;
+    }
+
+    /// Read the sample with the given ticket together with its weight
+    bool Read(uint64_t ticket, int64_t& sample_ticks, double& weight) const
+    {
+      const Slot& slot = m_slots[ticket & m_mask];
+      const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+      if (before != 2*ticket+2)
+        return false;
+      const int64_t ticks = slot.ticks.load(std::memory_order_relaxed);
+      const std::atomic<double>* weights =
+          m_weights.load(std::memory_order_acquire);
+      const double value = weights ? weights[ticket & m_mask].load(
+                                         std::memory_order_relaxed)
+                                   : 1.;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != before)
+        return false;
+      sample_ticks = ticks;
+      weight = value;
+      return true;
+    }
+
+    /// One past the newest ticket handed out so far
+    uint64_t Head() const
+    {
+      return m_head.load(std::memory_order_acquire);
+    }
+
+    /// Oldest ticket that has neither been discarded nor overwritten
+    uint64_t Oldest() const
+    {
+      const uint64_t head = Head();
+      const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+      return (head - tail > m_slots.size()) ? head - m_slots.size() : tail;
+    }
+
+    /// Drop all samples older than "ticket" (O(1))
+    void DiscardBefore(uint64_t ticket)
+    {
+      uint64_t tail = m_tail.load(std::memory_order_relaxed);
+      while (ticket > tail &&
+             !m_tail.compare_exchange_weak(tail, ticket,
+                                           std::memory_order_relaxed)) { }
+    }
+
+    /**
+     * Drop the samples taken at or before "cutoff" (ticks), except for
+     * the newest two of them: a window scan needs a sample at or before
+     * its start that is not the oldest one to know that it is covered.
+     * Assumes the samples are in time order and binary searches for the
+     * first one that is newer.
+     */
+    void DiscardUpTo(int64_t cutoff)
+    {
+      uint64_t low = Oldest();
+      uint64_t high = Head();
+      while (low < high) {
+        const uint64_t middle = low + (high-low)/2;
+        int64_t sample;
+        bool expired;
+        if (Read(middle, sample))
+          expired = (sample <= cutoff);
+        else
+          /// Overwritten slots are old, unpublished ones are new
+          expired = (middle + m_slots.size() <= Head());
+        if (expired)
+          low = middle+1;
+        else
+          high = middle;
+      }
+      DiscardBefore((low > 2) ? low-2 : 0);
+    }
+
+    /// Drop all samples
+    void Clear() { DiscardBefore(Head()); }
+
+    std::size_t Capacity() const { return m_slots.size(); }
+
+  private:
+
+    struct Slot {
+      std::atomic<uint64_t> sequence;
+      std::atomic<int64_t> ticks;
+    };
+
+    /// Reserve "count" consecutive tickets, returns the first one
+    uint64_t Claim(std::size_t count)
+    {
+      #ifdef THREAD_SAFE
+        return m_head.fetch_add(count, std::memory_order_relaxed);
+      #else
+        const uint64_t ticket = m_head.load(std::memory_order_relaxed);
+        m_head.store(ticket+count, std::memory_order_relaxed);
+        return ticket;
+      #endif
+    }
+
+    /// Write and publish a claimed slot
+    void Store(uint64_t ticket, int64_t ticks, double weight = 1.)
+    {
+      Slot& slot = m_slots[ticket & m_mask];
+      slot.sequence.store(2*ticket+1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.ticks.store(ticks, std::memory_order_relaxed);
+      std::atomic<double>* weights = m_weights.load(std::memory_order_acquire);
+      if (weights)
+        weights[ticket & m_mask].store(weight, std::memory_order_relaxed);
+      slot.sequence.store(2*ticket+2, std::memory_order_release);
+    }
+
+    /// Install the weight array, all weights 1
+    void AllocateWeights()
+    {
+      std::atomic<double>* weights = new std::atomic<double>[m_slots.size()];
+      for (std::size_t i = 0; i < m_slots.size(); ++i)
+        weights[i].store(1., std::memory_order_relaxed);
+      std::atomic<double>* expected = NULL;
+      if (!m_weights.compare_exchange_strong(expected, weights,
+                                             std::memory_order_acq_rel))
+        delete[] weights;
+    }
+
+    std::vector<Slot> m_slots;
+    /// Optional per-slot weights (NULL until a weighted sample arrives)
+    std::atomic<std::atomic<double>*> m_weights;
+    std::size_t m_mask;
+    std::atomic<uint64_t> m_head;
+    std::atomic<uint64_t> m_tail;
+  };
+
+  inline SampleRing::SampleRing(std::size_t capacity)
+  : m_weights(NULL),
+    m_mask(0),
+    m_head(0),
+    m_tail(0)
+  {
+    if (capacity == 0)
+      throw std::invalid_argument("SampleRing: Capacity must be positive");
+    std::size_t rounded = 1;
+    while (rounded < capacity)
+      rounded <<= 1;
+    std::vector<Slot> slots(rounded);
+    m_slots.swap(slots);
+    for (std::size_t i = 0; i < rounded; ++i) {
+      m_slots[i].sequence.store(0, std::memory_order_relaxed);
+      m_slots[i].ticks.store(0, std::memory_order_relaxed);
+    }
+    m_mask = rounded-1;
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// CounterWheel class (time-bucketed event counts)
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Circular timing wheel of event counters. Time is cut into buckets of
+   * a fixed width; each wheel slot holds the count of one bucket, packed
+   * together with the (truncated) round of that bucket, i.e. its index
+   * divided by Size(), into a single 64-bit word:
+   *
+   *   [ bucket round (upper 32 bits) | event count (lower 32 bits) ]
+   *
+   * The slot position gives the rest of the bucket index. A slot whose
+   * stored round does not match the bucket it is asked about is stale
+   * and counts as zero, so buckets expire implicitly when the wheel
+   * comes around. Whether an event is too old for the wheel is decided
+   * against the full 64-bit index of the newest bucket, so long idle
+   * gaps cannot make stale slots look newer. Adding is a single CAS
+   * loop, summing a window touches at most Size() slots. The slot array
+   * is padded by a cache line on either side so that separate wheels
+   * never share a line.
+   */
+  class CounterWheel {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param bucket_width Time span covered by one bucket
+     * @param max_window_seconds Longest window that can be summed
+     */
+    CounterWheel(TIME_RESOLUTION_T bucket_width,
+                 float max_window_seconds);
+
+    /// Count "count" events at "tick_ns" (nanoseconds since clock epoch);
+    /// events too old for the wheel are dropped
+    void Add(int64_t tick_ns, uint32_t count = 1);
+
+    /**
+     * Count "count" events at "tick_ns", and report a non-empty bucket
+     * that had to make way for it. Every bucket is evicted exactly once,
+     * so the evicted counts can be handed on without double counting.
+     * Events Size() or more buckets older than the newest one are too
+     * old for the wheel; they are not counted but reported as evicted.
+     *
+     * @returns TRUE iff a bucket with a nonzero count was evicted
+     */
+    bool Add(int64_t tick_ns,
+             uint32_t count,
+             int64_t& evicted_bucket,
+             uint32_t& evicted_count);
+
+    /**
+     * Sum up all events in (from_ns, to_ns]. The bucket containing
+     * "from_ns" contributes proportionally to its overlap with the range.
+     *
+     * @returns the (fractional) event count, or a negative value if the
+     *          range reaches further back than the wheel retains
+     */
+    double Sum(int64_t from_ns, int64_t to_ns) const;
+
+    /**
+     * Like Sum(), but also include buckets that are older than the wheel
+     * span and have not been evicted yet. Buckets are identified relative
+     * to "to_ns", and a bucket that is still filling up counts as covered
+     * up to "to_ns" only.
+     */
+    double SumResident(int64_t from_ns, int64_t to_ns) const;
+
+    /// Zero all buckets
+    void Clear();
+
+    int64_t BucketWidth() const { return m_bucket_width; }
+    std::size_t Size() const { return m_mask+1; }
+
+  private:
+
+    /// Unused slots before and after the wheel
+    static const std::size_t PADDING = CACHE_LINE_BYTES/sizeof(uint64_t);
+
+    static uint64_t Pack(uint32_t round, uint32_t count)
+    {
+      return (static_cast<uint64_t>(round) << 32) | count;
+    }
+
+    /// Truncated round of "bucket", as stored in its slot
+    uint32_t Round(int64_t bucket) const
+    {
+      return static_cast<uint32_t>(bucket >> m_shift);
+    }
+
+    /// Raise the newest bucket to "bucket"; returns the new newest one
+    int64_t RaiseNewest(int64_t bucket);
+
+    /// Slots, and the newest bucket in the first (padding) word
+    std::vector<std::atomic<uint64_t> > m_slots;
+    std::size_t m_mask;
+    int m_shift;
+    int64_t m_bucket_width;
+  };
+
+  inline CounterWheel::CounterWheel(TIME_RESOLUTION_T bucket_width,
+                                    float max_window_seconds)
+  : m_mask(0),
+    m_shift(0),
+    m_bucket_width(bucket_width.count())
+  {
+    if (m_bucket_width <= 0)
+      throw std::invalid_argument("CounterWheel: Bucket width must be positive");
+    if (max_window_seconds <= 0.f)
+      throw std::invalid_argument("CounterWheel: Window must be positive");
+
+    /// One extra slot for the partially covered oldest bucket
+    const double buckets = max_window_seconds * 1e9 / m_bucket_width;
+    std::size_t rounded = 1;
+    while (rounded < static_cast<std::size_t>(buckets) + 2)
+      rounded <<= 1;
+    std::vector<std::atomic<uint64_t> > slots(rounded + 2*PADDING);
+    m_slots.swap(slots);
+    m_mask = rounded-1;
+    while ((std::size_t(1) << m_shift) < rounded)
+      ++m_shift;
+    Clear();
+  }
+
+  inline int64_t CounterWheel::RaiseNewest(int64_t bucket)
+  {
+    std::atomic<uint64_t>& word = m_slots[0];
+    uint64_t current = word.load(std::memory_order_relaxed);
+    while (bucket > static_cast<int64_t>(current)) {
+      if (word.compare_exchange_weak(current, static_cast<uint64_t>(bucket),
+                                     std::memory_order_relaxed))
+        return bucket;
+    }
+    return static_cast<int64_t>(current);
+  }
+
+  inline void CounterWheel::Add(int64_t tick_ns, uint32_t count)
+  {
+    int64_t evicted_bucket;
+    uint32_t evicted_count;
+    Add(tick_ns, count, evicted_bucket, evicted_count);
+  }
+
+  inline bool CounterWheel::Add(int64_t tick_ns,
+                                uint32_t count,
+                                int64_t& evicted_bucket,
+                                uint32_t& evicted_count)
+  {
+    if (count == 0)
+      return false;
+    const int64_t bucket = FloorDivide(tick_ns, m_bucket_width);
+    const int64_t size = static_cast<int64_t>(Size());
+    if (bucket <= RaiseNewest(bucket) - size) {
+      /// Too old for the wheel: hand the events themselves on
+      evicted_bucket = bucket;
+      evicted_count = count;
+      return true;
+    }
+    const uint32_t round = Round(bucket);
+    std::atomic<uint64_t>& slot = m_slots[PADDING + (bucket & m_mask)];
+
+    /// Acquire, so that a newer bucket in the slot implies a newest bucket
+    /// at least as new
+    uint64_t expected = slot.load(std::memory_order_acquire);
+    uint64_t desired;
+    do {
+      const int32_t ahead = static_cast<int32_t>(
+                                static_cast<uint32_t>(expected >> 32) - round);
+      if (ahead == 0) {
+        desired = expected + count;
+      } else if ((expected & 0xffffffffu) == 0 || ahead < 0 ||
+                 bucket + ahead*size > static_cast<int64_t>(
+                     m_slots[0].load(std::memory_order_relaxed))) {
+        /// Empty or older; a "newer" bucket beyond the newest one is in
+        /// fact one that the truncated round wrapped around
+        desired = Pack(round, count);
+      } else {
+        /// A newer bucket took the slot while this event was on its way
+        evicted_bucket = bucket;
+        evicted_count = count;
+        return true;
+      }
+    } while (!slot.compare_exchange_weak(expected, desired,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire));
+
+    const uint32_t old_round = static_cast<uint32_t>(expected >> 32);
+    evicted_count = static_cast<uint32_t>(expected & 0xffffffffu);
+    if (old_round == round || evicted_count == 0)
+      return false;
+    evicted_bucket = bucket - static_cast<int64_t>(
+                                  static_cast<uint32_t>(round - old_round))*size;
+    return true;
+  }
+
+  inline double CounterWheel::Sum(int64_t from_ns, int64_t to_ns) const
+  {
+    const int64_t first = FloorDivide(from_ns, m_bucket_width);
+    const int64_t last  = FloorDivide(to_ns, m_bucket_width);
+    if (last-first+1 > static_cast<int64_t>(Size()))
+      return -1.;
+
+    double sum = 0.;
+    for (int64_t bucket = first; bucket <= last; ++bucket) {
+      const uint64_t value = m_slots[PADDING + (bucket & m_mask)].load(
+                                 std::memory_order_relaxed);
+      if (static_cast<uint32_t>(value >> 32) != Round(bucket))
+        continue;
+      const double count = static_cast<double>(value & 0xffffffffu);
+      if (bucket == first) {
+        /// Only the part of the oldest bucket after "from_ns" is inside
+        const double covered = (first+1)*m_bucket_width - from_ns;
+        sum += count * covered / m_bucket_width;
+      } else {
+        sum += count;
+      }
+    }
+    return sum;
+  }
+
+  inline double CounterWheel::SumResident(int64_t from_ns, int64_t to_ns) const
+  {
+    const int64_t newest = FloorDivide(to_ns, m_bucket_width);
+    const int64_t newest_round = newest >> m_shift;
+
+    double sum = 0.;
+    for (std::size_t i = 0; i < Size(); ++i) {
+      const uint64_t value = m_slots[PADDING + i].load(
+                                 std::memory_order_relaxed);
+      const double count = static_cast<double>(value & 0xffffffffu);
+      if (count == 0.)
+        continue;
+      const int64_t round = newest_round - static_cast<uint32_t>(
+                                Round(newest) - static_cast<uint32_t>(value >> 32));
+      const int64_t bucket = (round << m_shift) | static_cast<int64_t>(i);
+      if (bucket > newest)
+        continue;
+      const int64_t start = bucket*m_bucket_width;
+      const int64_t end = (start+m_bucket_width < to_ns)
+                          ? start+m_bucket_width : to_ns;
+      if (end <= from_ns || end <= start)
+        continue;
+      if (start >= from_ns)
+        sum += count;
+      else
+        sum += count * (end-from_ns) / (end-start);
+    }
+    return sum;
+  }
+
+  inline void CounterWheel::Clear()
+  {
+    /// Empty slots count as zero whatever their round
+    for (std::size_t i = 0; i < Size(); ++i)
+      m_slots[PADDING + i].store(0, std::memory_order_relaxed);
+    m_slots[0].store(static_cast<uint64_t>(INT64_MIN),
+                     std::memory_order_relaxed);
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// RateRollup class (multi-resolution event counts)
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Event counts at three resolutions with constant memory:
+   *
+   *   Level    Bucket width   Buckets   Span
+   *   seconds  1 s            128       ~2 minutes
+   *   minutes  1 min          120       2 hours
+   *   hours    1 h            168       1 week
+   *
+   * New events only ever touch the seconds level (a lock-free
+   * CounterWheel). When a seconds bucket is evicted to make room, its
+   * count is folded into the minutes bucket it belongs to, and evicted
+   * minutes buckets are folded into hours in turn. Late events that are
+   * too old for the seconds wheel go straight to the coarser levels.
+   * Every event is thus held by exactly one level at any time, and Sum()
+   * adds up all levels.
+   * The coarse levels are only touched about once per second, so they
+   * are guarded by a mutex.
+   */
+  class RateRollup {
+
+  public:
+
+    /// Constructor
+    RateRollup();
+
+    /// Count "count" events at "tick_ns"
+    void Add(int64_t tick_ns, uint32_t count = 1);
+
+    /**
+     * Count the events in (from_ns, to_ns]. Coarse buckets that are only
+     * partially inside the range contribute in proportion to the part of
+     * the time they actually cover (that of the sub-buckets folded into
+     * them) which lies inside the range.
+     */
+    double Sum(int64_t from_ns, int64_t to_ns) const;
+
+    /// Time span (ticks) covered by the coarsest level
+    int64_t Horizon() const;
+
+    /// Drop all counts
+    void Clear();
+
+  private:
+
+    struct CoarseLevel {
+      int64_t width;
+      std::vector<int64_t> buckets;
+      std::vector<uint64_t> counts;
+      /// Time range [first, last) covered by the folded sub-buckets
+      std::vector<int64_t> first;
+      std::vector<int64_t> last;
+    };
+
+    /// Fold "count" events covering [start_ns, end_ns) into a level
+    void Fold(std::size_t level,
+              int64_t start_ns,
+              int64_t end_ns,
+              uint64_t count);
+
+    CounterWheel m_seconds;
+    std::vector<CoarseLevel> m_coarse;
+    mutable std::mutex m_coarse__mutex;
+  };
+
+  inline RateRollup::RateRollup()
+  : m_seconds(std::chrono::seconds(1), 120.f)
+  {
+    const int64_t widths[] = {SecondsToTicks(60.f), SecondsToTicks(3600.f)};
+    const std::size_t sizes[] = {120, 168};
+    for (std::size_t level = 0; level < 2; ++level) {
+      CoarseLevel coarse;
+      coarse.width = widths[level];
+      coarse.buckets.assign(sizes[level], INT64_MIN);
+      coarse.counts.assign(sizes[level], 0);
+      coarse.first.assign(sizes[level], 0);
+      coarse.last.assign(sizes[level], 0);
+      m_coarse.push_back(coarse);
+    }
+  }
+
+  inline void RateRollup::Add(int64_t tick_ns, uint32_t count)
+  {
+    int64_t evicted_bucket;
+    uint32_t evicted_count;
+    if (m_seconds.Add(tick_ns, count, evicted_bucket, evicted_count)) {
+      std::lock_guard<std::mutex> lock(m_coarse__mutex);
+      const int64_t width = m_seconds.BucketWidth();
+      Fold(0, evicted_bucket*width, (evicted_bucket+1)*width, evicted_count);
+    }
+  }
+
+  inline void RateRollup::Fold(std::size_t level,
+                               int64_t start_ns,
+                               int64_t end_ns,
+                               uint64_t count)
+  {
+    /// Beyond the coarsest level, counts are dropped
+    if (level >= m_coarse.size())
+      return;
+
+    CoarseLevel& coarse = m_coarse[level];
+    const int64_t bucket = FloorDivide(start_ns, coarse.width);
+    const int64_t slots = static_cast<int64_t>(coarse.buckets.size());
+    const std::size_t slot = bucket - FloorDivide(bucket, slots)*slots;
+    if (coarse.buckets[slot] > bucket) {
+      /// Already too old for this level
+      Fold(level+1, start_ns, end_ns, count);
+      return;
+    }
+    if (coarse.buckets[slot] != bucket) {
+      if (coarse.counts[slot] > 0)
+        Fold(level+1, coarse.first[slot], coarse.last[slot],
+             coarse.counts[slot]);
+      coarse.buckets[slot] = bucket;
+      coarse.counts[slot] = 0;
+      coarse.first[slot] = start_ns;
+      coarse.last[slot] = end_ns;
+    }
+    if (start_ns < coarse.first[slot])
+      coarse.first[slot] = start_ns;
+    if (end_ns > coarse.last[slot])
+      coarse.last[slot] = end_ns;
+    coarse.counts[slot] += count;
+  }
+
+  inline double RateRollup::Sum(int64_t from_ns, int64_t to_ns) const
+  {
+    double sum = m_seconds.SumResident(from_ns, to_ns);
+
+    std::lock_guard<std::mutex> lock(m_coarse__mutex);
+    for (std::size_t level = 0; level < m_coarse.size(); ++level) {
+      const CoarseLevel& coarse = m_coarse[level];
+      for (std::size_t slot = 0; slot < coarse.buckets.size(); ++slot) {
+        if (coarse.counts[slot] == 0)
+          continue;
+        const int64_t start = coarse.first[slot];
+        const int64_t end = (coarse.last[slot] < to_ns)
+                            ? coarse.last[slot] : to_ns;
+        if (end <= from_ns || end <= start)
+          continue;
+        if (start >= from_ns)
+          sum += coarse.counts[slot];
+        else
+          sum += static_cast<double>(coarse.counts[slot]) *
+                 (end-from_ns) / (end-start);
+      }
+    }
+    return sum;
+  }
+
+  inline int64_t RateRollup::Horizon() const
+  {
+    const CoarseLevel& coarsest = m_coarse.back();
+    return coarsest.width * static_cast<int64_t>(coarsest.buckets.size()-1);
+  }
+
+  inline void RateRollup::Clear()
+  {
+    m_seconds.Clear();
+    std::lock_guard<std::mutex> lock(m_coarse__mutex);
+    for (std::size_t level = 0; level < m_coarse.size(); ++level) {
+      m_coarse[level].buckets.assign(m_coarse[level].buckets.size(), INT64_MIN);
+      m_coarse[level].counts.assign(m_coarse[level].counts.size(), 0);
+    }
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// IntervalHistogram class (windowed log-bucketed interval counts)
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Histogram of time intervals (ticks) in the style of HdrHistogram:
+   * values below 16 ns get a bucket each, above that every power of two
+   * is split into 16 linear sub-buckets, so any value is known to within
+   * 1/16 (~6%) of itself. Intervals of up to 2^41 ns (~37 minutes) are
+   * resolved; longer ones land in the last bucket.
+   *
+   * To answer questions about a recent window, the histogram is kept as
+   * a ring of time slices. Add() increments one atomic counter of the
+   * current slice; the first producer to enter a new slice clears it
+   * (under a mutex, once per slice). Queries merge the slices that
+   * overlap the window, so the window is rounded up to whole slices.
+   */
+  class IntervalHistogram {
+
+  public:
+
+    /// Number of value buckets
+    static const std::size_t BUCKETS = 16 + 37*16;
+
+    /**
+     * Constructor
+     *
+     * @param max_window_seconds Longest window that can be queried
+     * @param slices Number of time slices the window is divided into
+     */
+    IntervalHistogram(float max_window_seconds, std::size_t slices);
+
+    /// Count "count" intervals of length "interval" that ended at "now"
+    void Add(int64_t now, int64_t interval, uint32_t count = 1);
+
+    /**
+     * Add up the counts of all slices that overlap (from, to]
+     *
+     * @param counts Receives BUCKETS counts
+     *
+     * @returns the total number of intervals
+     */
+    uint64_t Merge(int64_t from, int64_t to,
+                   std::vector<uint64_t>& counts) const;
+
+    /// Drop all counts
+    void Clear();
+
+    /// Value bucket of an interval
+    static std::size_t BucketIndex(int64_t interval);
+
+    /// Smallest interval in a value bucket, and the bucket's width
+    static int64_t BucketStart(std::size_t index);
+    static int64_t BucketWidth(std::size_t index);
+
+    /**
+     * The interval below which a fraction "quantile" of the merged
+     * "counts" lies (linearly interpolated inside the bucket)
+     */
+    static double Quantile(const std::vector<uint64_t>& counts,
+                           uint64_t total,
+                           double quantile);
+
+    /// Mean of the longest "fraction" of the merged "counts"
+    static double TailMean(const std::vector<uint64_t>& counts,
+                           uint64_t total,
+                           double fraction);
+
+  private:
+
+    struct Slice {
+      std::atomic<int64_t> id;
+      std::vector<std::atomic<uint32_t> > counts;
+    };
+
+    std::vector<Slice> m_slices;
+    int64_t m_slice_width;
+    std::mutex m_rollover__mutex;
+  };
+
+  inline IntervalHistogram::IntervalHistogram(float max_window_seconds,
+                                              std::size_t slices)
+  : m_slice_width(0)
+  {
+    if (max_window_seconds <= 0.f || slices == 0)
+      throw std::invalid_argument("IntervalHistogram: Window and slice "
+                                  "count must be positive");
+    /// One extra slice, which is filling up while the oldest one expires
+    std::vector<Slice> ring(slices+1);
+    m_slices.swap(ring);
+    m_slice_width = SecondsToTicks(max_window_seconds) /
+                    static_cast<int64_t>(slices);
+    if (m_slice_width <= 0)
+      m_slice_width = 1;
+    for (std::size_t i = 0; i < m_slices.size(); ++i) {
+      std::vector<std::atomic<uint32_t> > counts(BUCKETS);
+      m_slices[i].counts.swap(counts);
+    }
+    Clear();
+  }
+
+  inline std::size_t IntervalHistogram::BucketIndex(int64_t interval)
+  {
+    if (interval < 16)
+      return (interval < 0) ? 0 : static_cast<std::size_t>(interval);
+    int exponent = 63 - LeadingZeros(static_cast<uint64_t>(interval));
+    if (exponent > 40)
+      return BUCKETS-1;
+    const std::size_t mantissa = (interval >> (exponent-4)) & 15;
+    return 16 + (exponent-4)*16 + mantissa;
+  }
+
+  inline int64_t IntervalHistogram::BucketStart(std::size_t index)
+  {
+    if (index < 16)
+      return static_cast<int64_t>(index);
+    const int exponent = static_cast<int>((index-16)/16) + 4;
+    const int64_t mantissa = static_cast<int64_t>((index-16)%16);
+    return (16+mantissa) << (exponent-4);
+  }
+
+  inline int64_t IntervalHistogram::BucketWidth(std::size_t index)
+  {
+    if (index < 16)
+      return 1;
+    return int64_t(1) << ((index-16)/16);
+  }
+
+  inline void IntervalHistogram::Add(int64_t now,
+                                     int64_t interval,
+                                     uint32_t count)
+  {
+    const int64_t id = FloorDivide(now, m_slice_width);
+    Slice& slice = m_slices[id % static_cast<int64_t>(m_slices.size())];
+    if (slice.id.load(std::memory_order_acquire) != id) {
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      if (slice.id.load(std::memory_order_relaxed) < id) {
+        for (std::size_t i = 0; i < BUCKETS; ++i)
+          slice.counts[i].store(0, std::memory_order_relaxed);
+        slice.id.store(id, std::memory_order_release);
+      } else if (slice.id.load(std::memory_order_relaxed) > id) {
+        /// Too old for the ring
+        return;
+      }
+    }
+    slice.counts[BucketIndex(interval)].fetch_add(count,
+                                                  std::memory_order_relaxed);
+  }
+
+  inline uint64_t IntervalHistogram::Merge(int64_t from, int64_t to,
+                                           std::vector<uint64_t>& counts) const
+  {
+    counts.assign(BUCKETS, 0);
+    const int64_t first = FloorDivide(from, m_slice_width);
+    const int64_t last = FloorDivide(to, m_slice_width);
+    uint64_t total = 0;
+    for (std::size_t s = 0; s < m_slices.size(); ++s) {
+      const Slice& slice = m_slices[s];
+      const int64_t id = slice.id.load(std::memory_order_acquire);
+      if (id < first || id > last)
+        continue;
+      for (std::size_t i = 0; i < BUCKETS; ++i) {
+        const uint32_t count = slice.counts[i].load(std::memory_order_relaxed);
+        counts[i] += count;
+        total += count;
+      }
+    }
+    return total;
+  }
+
+  inline void IntervalHistogram::Clear()
+  {
+    std::lock_guard<std::mutex> lock(m_rollover__mutex);
+    for (std::size_t s = 0; s < m_slices.size(); ++s) {
+      m_slices[s].id.store(INT64_MIN, std::memory_order_relaxed);
+      for (std::size_t i = 0; i < BUCKETS; ++i)
+        m_slices[s].counts[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  inline double IntervalHistogram::Quantile(const std::vector<uint64_t>& counts,
+                                            uint64_t total,
+                                            double quantile)
+  {
+    const double rank = quantile * total;
+    double below = 0.;
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+      if (counts[i] == 0)
+        continue;
+      if (below + counts[i] >= rank) {
+        const double inside = (rank-below) / counts[i];
+        return BucketStart(i) + inside*BucketWidth(i);
+      }
+      below += counts[i];
+    }
+    return static_cast<double>(BucketStart(counts.size()-1));
+  }
+
+  inline double IntervalHistogram::TailMean(const std::vector<uint64_t>& counts,
+                                            uint64_t total,
+                                            double fraction)
+  {
+    double wanted = fraction * total;
+    if (wanted < 1.)
+      wanted = 1.;
+    double taken = 0.;
+    double sum = 0.;
+    for (std::size_t i = counts.size(); i-- > 0 && taken < wanted; ) {
+      if (counts[i] == 0)
+        continue;
+      const double take = (counts[i] < wanted-taken) ? counts[i]
+                                                      : wanted-taken;
+      sum += take * (BucketStart(i) + 0.5*BucketWidth(i));
+      taken += take;
+    }
+    return (taken > 0.) ? sum/taken : 0.;
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// IntervalSketch class (mergeable relative-error quantile sketch)
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * DDSketch of time intervals (ticks): an interval x >= 1 is counted in
+   * bucket ceil(log(x) / log(gamma)) with gamma = (1+alpha)/(1-alpha),
+   * which makes every quantile accurate to a relative error of alpha.
+   * The buckets form a fixed array covering 1 tick up to "max_seconds";
+   * shorter intervals share a zero bucket and longer ones the last
+   * bucket, so memory stays bounded no matter how long the sketch runs.
+   *
+   * Unlike IntervalHistogram this is cumulative rather than windowed,
+   * and two sketches with the same parameters can be merged exactly by
+   * adding their counts, e.g. to combine per-thread or per-process
+   * estimators without shipping timestamps. Add() is lock-free.
+   */
+  class IntervalSketch {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param relative_accuracy Relative error of quantiles (alpha)
+     * @param max_seconds Longest interval resolved by the sketch
+     */
+    explicit IntervalSketch(double relative_accuracy = 0.01,
+                            double max_seconds = 3600.);
+
+    /// Copies take a snapshot of the counts
+    IntervalSketch(const IntervalSketch& other);
+    IntervalSketch& operator=(const IntervalSketch& other);
+
+    /// Count "count" intervals of length "interval"
+    void Add(int64_t interval, uint64_t count = 1);
+
+    /**
+     * Add the counts of "other" to this sketch
+     *
+     * @throws std::invalid_argument if the sketches' parameters differ
+     */
+    void Merge(const IntervalSketch& other);
+
+    /// The interval (in seconds) below which a fraction "quantile" of
+    /// the counted intervals lies, or -1 if the sketch is empty
+    double Quantile(double quantile) const;
+
+    /// Number of counted intervals
+    uint64_t Count() const;
+
+    double RelativeAccuracy() const { return m_alpha; }
+
+    /// Drop all counts
+    void Clear();
+
+  private:
+
+    /// Representative interval (ticks) of a bucket
+    double BucketValue(std::size_t index) const;
+
+    double m_alpha;
+    double m_log_gamma;
+    std::vector<std::atomic<uint64_t> > m_counts;
+    std::atomic<uint64_t> m_zero_count;
+  };
+
+  inline IntervalSketch::IntervalSketch(double relative_accuracy,
+                                        double max_seconds)
+  : m_alpha(relative_accuracy),
+    m_log_gamma(0.),
+    m_zero_count(0)
+  {
+    if (!(relative_accuracy > 0. && relative_accuracy < 1.) ||
+        !(max_seconds > 0.))
+      throw std::invalid_argument("IntervalSketch: Accuracy must be in "
+                                  "(0, 1) and the range positive");
+    m_log_gamma = std::log((1.+m_alpha) / (1.-m_alpha));
+    const double max_ticks = max_seconds *
+                             TIME_RESOLUTION_T(std::chrono::seconds(1)).count();
+    const double buckets = std::ceil(std::log(max_ticks) / m_log_gamma) + 1.;
+    std::vector<std::atomic<uint64_t> > counts(
+        buckets > 1. ? static_cast<std::size_t>(buckets) : 1);
+    m_counts.swap(counts);
+    Clear();
+  }
+
+  inline IntervalSketch::IntervalSketch(const IntervalSketch& other)
+  : m_alpha(other.m_alpha),
+    m_log_gamma(other.m_log_gamma),
+    m_counts(other.m_counts.size()),
+    m_zero_count(0)
+  {
+    Clear();
+    Merge(other);
+  }
+
+  inline IntervalSketch& IntervalSketch::operator=(const IntervalSketch& other)
+  {
+    if (this != &other) {
+      if (m_counts.size() != other.m_counts.size()) {
+        std::vector<std::atomic<uint64_t> > counts(other.m_counts.size());
+        m_counts.swap(counts);
+      }
+      m_alpha = other.m_alpha;
+      m_log_gamma = other.m_log_gamma;
+      Clear();
+      Merge(other);
+    }
+    return *this;
+  }
+
+  inline void IntervalSketch::Add(int64_t interval, uint64_t count)
+  {
+    if (interval < 1) {
+      m_zero_count.fetch_add(count, std::memory_order_relaxed);
+      return;
+    }
+    const double key = std::ceil(std::log(static_cast<double>(interval)) /
+                                 m_log_gamma);
+    const std::size_t index =
+        (key < m_counts.size()) ? static_cast<std::size_t>(key)
+                                : m_counts.size()-1;
+    m_counts[index].fetch_add(count, std::memory_order_relaxed);
+  }
+
+  inline void IntervalSketch::Merge(const IntervalSketch& other)
+  {
+    if (other.m_alpha != m_alpha || other.m_counts.size() != m_counts.size())
+      throw std::invalid_argument("IntervalSketch: Cannot merge sketches "
+                                  "with different parameters");
+    m_zero_count.fetch_add(other.m_zero_count.load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+    for (std::size_t i = 0; i < m_counts.size(); ++i) {
+      const uint64_t count = other.m_counts[i].load(std::memory_order_relaxed);
+      if (count)
+        m_counts[i].fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+
+  inline double IntervalSketch::BucketValue(std::size_t index) const
+  {
+    /// Midpoint (in relative terms) of (gamma^(i-1), gamma^i]
+    return 2. * std::exp(index*m_log_gamma) / (1. + std::exp(m_log_gamma));
+  }
+
+  inline double IntervalSketch::Quantile(double quantile) const
+  {
+    const uint64_t total = Count();
+    if (total == 0)
+      return -1.;
+    const double seconds_per_tick =
+        1. / TIME_RESOLUTION_T(std::chrono::seconds(1)).count();
+    const double rank = quantile * (total-1);
+    double below = static_cast<double>(
+                       m_zero_count.load(std::memory_order_relaxed));
+    if (below > rank)
+      return 0.;
+    for (std::size_t i = 0; i < m_counts.size(); ++i) {
+      below += m_counts[i].load(std::memory_order_relaxed);
+      if (below > rank)
+        return BucketValue(i) * seconds_per_tick;
+    }
+    return BucketValue(m_counts.size()-1) * seconds_per_tick;
+  }
+
+  inline uint64_t IntervalSketch::Count() const
+  {
+    uint64_t total = m_zero_count.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < m_counts.size(); ++i)
+      total += m_counts[i].load(std::memory_order_relaxed);
+    return total;
+  }
+
+  inline void IntervalSketch::Clear()
+  {
+    m_zero_count.store(0, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < m_counts.size(); ++i)
+      m_counts[i].store(0, std::memory_order_relaxed);
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// DecayingRate class (continuous-time exponentially weighted rate)
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Exponentially decaying event rate with time constant tau: every
+   * event at time t_i contributes exp(-(now-t_i)/tau)/tau, so the rate
+   * of a steady stream converges to its true value, and the smoothing
+   * depends on elapsed time only, not on how often it is read.
+   *
+   * Rather than decaying a running sum on every update (which needs the
+   * time of the previous update, i.e. a lock), the sum is kept relative
+   * to a fixed origin t0 and in the log domain:
+   *
+   *   L = log(sum_i exp((t_i-t0)/tau))
+   *
+   * An event is a single CAS on L (log-add-exp of (t-t0)/tau), and the
+   * rate at time "now" is exp(L - (now-t0)/tau) / tau. Memory and both
+   * operations are O(1). Like any EWMA the rate starts from zero, so it
+   * underestimates during the first few tau after Clear().
+   */
+  class DecayingRate {
+
+  public:
+
+    /// Constructor, "tau_seconds" being the time constant
+    explicit DecayingRate(float tau_seconds);
+
+    /// Count "count" events at "ticks"
+    void Add(int64_t ticks, std::size_t count = 1);
+
+    /// Rate (events per second) at "now"
+    double Rate(int64_t now) const;
+
+    /// Forget all events, starting over with origin "origin"
+    void Clear(int64_t origin);
+
+  private:
+
+    double m_tau;
+    std::atomic<int64_t> m_origin;
+    std::atomic<double> m_log_sum;
+  };
+
+  inline DecayingRate::DecayingRate(float tau_seconds)
+  : m_tau(static_cast<double>(SecondsToTicks(tau_seconds))),
+    m_origin(0),
+    m_log_sum(-HUGE_VAL)
+  {
+    if (!(m_tau > 0.))
+      throw std::invalid_argument("DecayingRate: Time constant must be "
+                                  "positive");
+  }
+
+  inline void DecayingRate::Add(int64_t ticks, std::size_t count)
+  {
+    /// log(0) would turn the sum into NaN for good
+    if (count == 0)
+      return;
+    AddLogExp(m_log_sum,
+              (ticks - m_origin.load(std::memory_order_relaxed)) / m_tau +
+              std::log(static_cast<double>(count)));
+  }
+
+  inline double DecayingRate::Rate(int64_t now) const
+  {
+    const double elapsed =
+        (now - m_origin.load(std::memory_order_relaxed)) / m_tau;
+    const double ticks_per_second =
+        TIME_RESOLUTION_T(std::chrono::seconds(1)).count();
+    return std::exp(m_log_sum.load(std::memory_order_relaxed) - elapsed) *
+           ticks_per_second / m_tau;
+  }
+
+  inline void DecayingRate::Clear(int64_t origin)
+  {
+    m_origin.store(origin, std::memory_order_relaxed);
+    m_log_sum.store(-HUGE_VAL, std::memory_order_relaxed);
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// SpanStats class (in-flight count and latency of timed spans)
+  /// /////////////////////////////////////////////////////////////////
+  /// Handed out by BeginSpan(), passed back to EndSpan()
+  struct SpanToken {
+    TIME_POINT_T started;
+  };
+
+  /**
+   * Bookkeeping behind the estimators' BeginSpan()/EndSpan(): a counter
+   * of spans in flight and, once enabled, a windowed IntervalHistogram of
+   * span latencies. The estimator counts the completion as a sample with
+   * the same clock read, so one span costs two clock reads in total.
+   */
+  class SpanStats {
+
+  public:
+
+    SpanStats() : m_in_flight(0), m_latency(NULL) { }
+    ~SpanStats() { delete m_latency.load(); }
+
+    void Begin() { m_in_flight.fetch_add(1, std::memory_order_relaxed); }
+
+    /// Finish a span that started at "started" and ended at "now"
+    void End(int64_t now, int64_t started)
+    {
+      m_in_flight.fetch_sub(1, std::memory_order_relaxed);
+      IntervalHistogram* latency = m_latency.load(std::memory_order_acquire);
+      if (latency)
+        latency->Add(now, now-started);
+    }
+
+    int64_t InFlight() const
+    {
+      return m_in_flight.load(std::memory_order_relaxed);
+    }
+
+    /// Start recording latencies (see IntervalHistogram)
+    void EnableLatency(float max_window_seconds, std::size_t slices)
+    {
+      if (!m_latency.load(std::memory_order_acquire))
+        InstallOnce(m_latency,
+                    new IntervalHistogram(max_window_seconds, slices));
+    }
+
+    /**
+     * Latency quantile of the spans that ended in the "window_seconds"
+     * before "now"
+     *
+     * @returns the latency in seconds, or a negative value if latencies
+     *          are not recorded or no span ended in the window
+     */
+    float Latency(int64_t now, float window_seconds, float quantile) const
+    {
+      const IntervalHistogram* latency =
+          m_latency.load(std::memory_order_acquire);
+      if (!latency)
+        return -1.f;
+      std::vector<uint64_t> counts;
+      const uint64_t total = latency->Merge(
+                                 now-SecondsToTicks(window_seconds), now,
+                                 counts);
+      if (total == 0)
+        return -1.f;
+      return static_cast<float>(
+                 IntervalHistogram::Quantile(counts, total, quantile) * 1e-9);
+    }
+
+    /// Forget recorded latencies (spans in flight stay in flight)
+    void Clear()
+    {
+      IntervalHistogram* latency = m_latency.load(std::memory_order_acquire);
+      if (latency)
+        latency->Clear();
+    }
+
+  private:
+
+    std::atomic<int64_t> m_in_flight;
+    std::atomic<IntervalHistogram*> m_latency;
+  };
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// HitchDetector class (flags unusually long inter-sample intervals)
+  /// /////////////////////////////////////////////////////////////////
+  /// One detected hitch
+  struct Hitch {
+    /// Time of the sample that ended the long interval
+    TIME_POINT_T when;
+    float interval_seconds;
+    /// Running median interval at the time of the hitch
+    float median_seconds;
+  };
+
+  /**
+   * Streaming stall detector. Each inter-sample interval is compared, in
+   * O(1), against an absolute budget and against a multiple of the
+   * running median interval. The median is tracked by a frugal streaming
+   * estimator, which nudges its estimate up or down by a fixed fraction
+   * per interval and so needs a single word of state.
+   *
+   * Hitches are counted, the newest ones are kept in a bounded ring, and
+   * an optional callback is invoked for each of them (on the thread
+   * that added the sample, outside of any lock). Intervals that are not
+   * hitches only touch the median estimate.
+   */
+  class HitchDetector {
+
+  public:
+
+    typedef std::function<void(const Hitch&)> Callback;
+
+    /**
+     * Constructor
+     *
+     * @param median_factor Intervals longer than this many running
+     *                      medians are hitches; 0 disables the check
+     * @param budget_seconds Intervals longer than this are hitches;
+     *                       0 disables the check
+     * @param capacity Number of hitches kept for Hitches()
+     * @param callback Called for every hitch (may be empty)
+     */
+    HitchDetector(float median_factor,
+                  float budget_seconds,
+                  std::size_t capacity,
+                  const Callback& callback);
+
+    /**
+     * Check the interval that ended at "now"
+     *
+     * @returns TRUE iff it was a hitch
+     */
+    bool Add(int64_t now, int64_t interval);
+
+    /**
+     * Copy the retained hitches, oldest first
+     *
+     * @returns the number of hitches since construction or Clear()
+     */
+    uint64_t Hitches(std::vector<Hitch>& hitches) const;
+
+    /// Number of hitches since construction or Clear()
+    uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+
+    /// Forget all hitches and the running median
+    void Clear();
+
+  private:
+
+    /// Intervals seen before the median check kicks in
+    static const uint32_t WARM_UP = 16;
+
+    float m_median_factor;
+    int64_t m_budget;
+    Callback m_callback;
+
+    /// Running median (ticks), updated without synchronisation
+    std::atomic<double> m_median;
+    std::atomic<uint32_t> m_seen;
+
+    std::atomic<uint64_t> m_count;
+    std::vector<Hitch> m_hitches;
+    mutable std::mutex m_hitches__mutex;
+  };
+
+  inline HitchDetector::HitchDetector(float median_factor,
+                                      float budget_seconds,
+                                      std::size_t capacity,
+                                      const Callback& callback)
+  : m_median_factor(median_factor),
+    m_budget(SecondsToTicks(budget_seconds)),
+    m_callback(callback),
+    m_median(0.),
+    m_seen(0),
+    m_count(0)
+  {
+    if (capacity == 0)
+      throw std::invalid_argument("HitchDetector: Capacity must be positive");
+    m_hitches.reserve(capacity);
+  }
+
+  inline bool HitchDetector::Add(int64_t now, int64_t interval)
+  {
+    const double median = m_median.load(std::memory_order_relaxed);
+    const uint32_t seen = m_seen.load(std::memory_order_relaxed);
+
+    /// Frugal median: step towards the new interval by 1/32 of itself
+    if (seen == 0)
+      m_median.store(static_cast<double>(interval), std::memory_order_relaxed);
+    else if (interval > median)
+      m_median.store(median + (median/32. > 1. ? median/32. : 1.),
+                     std::memory_order_relaxed);
+    else if (interval < median)
+      m_median.store(median - median/32., std::memory_order_relaxed);
+    if (seen < WARM_UP)
+      m_seen.store(seen+1, std::memory_order_relaxed);
+
+    const bool over_budget = m_budget > 0 && interval > m_budget;
+    const bool over_median = m_median_factor > 0.f && seen >= WARM_UP &&
+                             interval > m_median_factor * median;
+    if (!over_budget && !over_median)
+      return false;
+
+    const double seconds_per_tick =
+        1. / TIME_RESOLUTION_T(std::chrono::seconds(1)).count();
+    Hitch hitch;
+    hitch.when = TIME_POINT_T(TIME_RESOLUTION_T(now));
+    hitch.interval_seconds = static_cast<float>(interval * seconds_per_tick);
+    hitch.median_seconds = static_cast<float>(median * seconds_per_tick);
+    {
+      std::lock_guard<std::mutex> lock(m_hitches__mutex);
+      const uint64_t index = m_count.fetch_add(1, std::memory_order_relaxed);
+      if (m_hitches.size() < m_hitches.capacity())
+        m_hitches.push_back(hitch);
+      else
+        m_hitches[index % m_hitches.size()] = hitch;
+    }
+    if (m_callback)
+      m_callback(hitch);
+    return true;
+  }
+
+  inline uint64_t HitchDetector::Hitches(std::vector<Hitch>& hitches) const
+  {
+    std::lock_guard<std::mutex> lock(m_hitches__mutex);
+    const uint64_t count = m_count.load(std::memory_order_relaxed);
+    const std::size_t size = m_hitches.size();
+    hitches.clear();
+    hitches.reserve(size);
+    /// Once the ring is full, the oldest entry follows the newest one
+    const std::size_t oldest = (size < m_hitches.capacity()) ? 0
+                                                             : count % size;
+    for (std::size_t i = 0; i < size; ++i)
+      hitches.push_back(m_hitches[(oldest+i) % size]);
+    return count;
+  }
+
+  inline void HitchDetector::Clear()
+  {
+    std::lock_guard<std::mutex> lock(m_hitches__mutex);
+    m_hitches.clear();
+    m_count.store(0, std::memory_order_relaxed);
+    m_median.store(0., std::memory_order_relaxed);
+    m_seen.store(0, std::memory_order_relaxed);
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// RateChangeDetector class (sequential CUSUM test on the rate)
+  /// /////////////////////////////////////////////////////////////////
+  /// One detected rate change
+  struct RateChange {
+    /// Estimated start of the new rate
+    TIME_POINT_T when;
+    /// Time of the sample that confirmed the change
+    TIME_POINT_T detected;
+    float rate_before;
+    float rate_after;
+  };
+
+  /**
+   * Online change-point detector for the arrival rate. Arrivals are
+   * modelled as a Poisson process, so intervals are exponential with the
+   * baseline rate r0, the mean rate since the last change (testing
+   * starts after a warm-up of "warm_up" intervals). Two CUSUM
+   * statistics accumulate the log-likelihood ratio of each interval x
+   * against a rate shifted up or down by a factor (1+sensitivity). For
+   * n events within an interval x (n = 1 for single samples):
+   *
+   *   up:   n*log(1+s) - r0*s*x
+   *   down: r0*s/(1+s)*x - n*log(1+s)
+   *
+   * clamped at zero from below. When one of them exceeds "threshold" a
+   * change is signalled; the change is dated to the sample at which that
+   * statistic last left zero, and the new rate is estimated from the
+   * intervals since then; those intervals also start the new baseline.
+   * Every interval costs O(1) under a short lock, and a shift is
+   * typically confirmed within a few dozen intervals.
+   */
+  class RateChangeDetector {
+
+  public:
+
+    typedef std::function<void(const RateChange&)> Callback;
+
+    /**
+     * Constructor
+     *
+     * @param sensitivity Relative rate shift the test is tuned to detect
+     * @param threshold Log-likelihood ratio needed to signal a change;
+     *                  larger values mean fewer false alarms
+     * @param warm_up Intervals used to measure the (initial) baseline
+     * @param callback Called for every change (may be empty)
+     */
+    RateChangeDetector(float sensitivity,
+                       float threshold,
+                       uint32_t warm_up,
+                       const Callback& callback);
+
+    /**
+     * Test the interval that ended at "now", during which "count" events
+     * arrived (the last of them at "now")
+     *
+     * @returns TRUE iff it confirmed a rate change
+     */
+    bool Add(int64_t now, int64_t interval, uint64_t count = 1);
+
+    /**
+     * Most recent change
+     *
+     * @returns the number of changes since construction or Clear()
+     */
+    uint64_t LastChange(RateChange& change) const;
+
+    /// Baseline rate (events per second), or -1 while warming up
+    float Baseline() const;
+
+    /// Start over with a new warm-up
+    void Clear();
+
+  private:
+
+    /// One side of the two-sided test
+    struct Statistic {
+      double sum;
+      int64_t start;
+      uint64_t intervals;
+      int64_t span;
+    };
+
+    void Restart(Statistic& statistic, int64_t now);
+
+    double m_log_shift;
+    double m_shift;
+    double m_threshold;
+    uint32_t m_warm_up;
+    Callback m_callback;
+
+    /// Baseline rate in events per tick, 0 while warming up
+    double m_rate;
+    /// Intervals since the last change, which define the baseline
+    uint64_t m_baseline_intervals;
+    int64_t m_baseline_span;
+    Statistic m_up;
+    Statistic m_down;
+
+    uint64_t m_changes;
+    RateChange m_last_change;
+    mutable std::mutex m_state__mutex;
+  };
+
+  inline RateChangeDetector::RateChangeDetector(float sensitivity,
+                                                float threshold,
+                                                uint32_t warm_up,
+                                                const Callback& callback)
+  : m_log_shift(std::log1p(static_cast<double>(sensitivity))),
+    m_shift(sensitivity),
+    m_threshold(threshold),
+    m_warm_up(warm_up > 0 ? warm_up : 1),
+    m_callback(callback)
+  {
+    if (!(sensitivity > 0.f) || !(threshold > 0.f))
+      throw std::invalid_argument("RateChangeDetector: Sensitivity and "
+                                  "threshold must be positive");
+    Clear();
+  }
+
+  inline void RateChangeDetector::Restart(Statistic& statistic, int64_t now)
+  {
+    statistic.sum = 0.;
+    statistic.start = now;
+    statistic.intervals = 0;
+    statistic.span = 0;
+  }
+
+  inline bool RateChangeDetector::Add(int64_t now,
+                                      int64_t interval,
+                                      uint64_t count)
+  {
+    if (count == 0)
+      return false;
+    const double ticks_per_second =
+        TIME_RESOLUTION_T(std::chrono::seconds(1)).count();
+    RateChange change;
+    {
+      std::lock_guard<std::mutex> lock(m_state__mutex);
+      m_baseline_intervals += count;
+      m_baseline_span += interval;
+      if (m_rate == 0.) {
+        if (m_baseline_intervals >= m_warm_up && m_baseline_span > 0) {
+          m_rate = m_baseline_intervals /
+                   static_cast<double>(m_baseline_span);
+          Restart(m_up, now);
+          Restart(m_down, now);
+        }
+        return false;
+      }
+
+      const double scaled = m_rate * m_shift * interval;
+      const double log_shift = count * m_log_shift;
+      const double ratios[2] = { log_shift - scaled,
+                                 scaled / (1.+m_shift) - log_shift };
+      Statistic* statistics[2] = { &m_up, &m_down };
+      Statistic* alarm = NULL;
+      for (int side = 0; side < 2; ++side) {
+        Statistic& statistic = *statistics[side];
+        if (statistic.sum + ratios[side] <= 0.) {
+          Restart(statistic, now);
+          continue;
+        }
+        statistic.sum += ratios[side];
+        statistic.intervals += count;
+        statistic.span += interval;
+        if (statistic.sum > m_threshold)
+          alarm = &statistic;
+      }
+      if (!alarm) {
+        /// No change: refine the baseline with all intervals so far
+        m_rate = m_baseline_intervals / static_cast<double>(m_baseline_span);
+        return false;
+      }
+
+      const double rate_after =
+          (alarm->span > 0) ? alarm->intervals / static_cast<double>(alarm->span)
+                            : m_rate * (1.+m_shift);
+      change.when = TIME_POINT_T(TIME_RESOLUTION_T(alarm->start));
+      change.detected = TIME_POINT_T(TIME_RESOLUTION_T(now));
+      change.rate_before = static_cast<float>(m_rate * ticks_per_second);
+      change.rate_after = static_cast<float>(rate_after * ticks_per_second);
+      /// Measure the new baseline, starting from the intervals since
+      /// the change, before testing again
+      m_rate = 0.;
+      m_baseline_intervals = alarm->intervals;
+      m_baseline_span = alarm->span;
+      ++m_changes;
+      m_last_change = change;
+    }
+    if (m_callback)
+      m_callback(change);
+    return true;
+  }
+
+  inline uint64_t RateChangeDetector::LastChange(RateChange& change) const
+  {
+    std::lock_guard<std::mutex> lock(m_state__mutex);
+    if (m_changes)
+      change = m_last_change;
+    return m_changes;
+  }
+
+  inline float RateChangeDetector::Baseline() const
+  {
+    std::lock_guard<std::mutex> lock(m_state__mutex);
+    if (m_rate == 0.)
+      return -1.f;
+    return static_cast<float>(
+               m_rate * TIME_RESOLUTION_T(std::chrono::seconds(1)).count());
+  }
+
+  inline void RateChangeDetector::Clear()
+  {
+    std::lock_guard<std::mutex> lock(m_state__mutex);
+    m_rate = 0.;
+    m_baseline_intervals = 0;
+    m_baseline_span = 0;
+    Restart(m_up, 0);
+    Restart(m_down, 0);
+    m_changes = 0;
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicFPSEstimator class template declaration
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Clock-independent part, shared by all BasicFPSEstimator<> types
+  struct FPSEstimatorBase {
+    enum EstimationMethod {
+      CountSamples = 0,
+      AverageIntervals
+    };
+  };
+
+  template <typename ClockT = SteadyClock>
+  class BasicFPSEstimator : public FPSEstimatorBase {
+    
+  public:
+
+    /**
+     * Default number of retained samples (rounded up to a power of two):
+     * 1 s windows at up to ~65 kHz, for 1 MiB (16 bytes per sample)
+     */
+    static const std::size_t DEFAULT_CAPACITY = 65536;
+
+    /**
+     * Constructor
+     *
+     * @param capacity Maximum number of retained samples. Older samples
+     *                 are evicted once this many have been stored, so the
+     *                 memory footprint (16 bytes per sample) is fixed at
+     *                 construction. Windows that need more samples than
+     *                 this return -1, so size it as the highest rate
+     *                 times the longest window queried.
+     */
+    explicit BasicFPSEstimator(std::size_t capacity = DEFAULT_CAPACITY);
+        
+    /// Destructor
+    ~BasicFPSEstimator();
+    
+    /// Set decay factor
+    void SetDecayFactor(
+          float new_decay_factor = 0.f);
+
+    /**
+     * Set the retention window. Samples older than this are discarded
+     * as new samples arrive: whenever a quarter of the retention window
+     * has passed since the last compaction, one producer advances the
+     * ring's tail past the expired samples (a binary search, no copying).
+     * Independently of this, the ring capacity bounds memory at all times.
+     *
+     * @param max_retention_seconds Longest window that FPS() needs to
+     *        answer; 0 keeps samples until the ring evicts them
+     */
+    void SetRetention(
+          float max_retention_seconds = 0.f);
+
+    /// Add a sample
+    void AddSample();    
+
+    /**
+     * Add a sample with an externally measured time point (e.g. a kernel
+     * receive timestamp). Time points must come from the same time base
+     * as ClockT::Now(), and should arrive roughly in order: the window
+     * scan walks back from the newest sample and stops at the first one
+     * that lies before the window.
+     */
+    void AddSample(const TIME_POINT_T& when);
+
+    /// Add a batch of samples in one go (one ticket claim for all)
+    void AddSamples(const TIME_POINT_T* begin, const TIME_POINT_T* end);
+
+    /// Add "count" samples that all happened at "when"
+    void AddSamples(std::size_t count, const TIME_POINT_T& when);
+
+    /**
+     * Add a sample carrying a weight, e.g. the number of bytes or items
+     * it represents. Throughput() reports the sum of weights per second;
+     * FPS() keeps counting samples. Unweighted samples weigh 1.
+     */
+    void AddSample(double weight);
+
+    /// Add a weighted sample with an externally measured time point
+    void AddSample(const TIME_POINT_T& when, double weight);
+
+    /**
+     * Start timing a span (e.g. a request). Spans also count towards
+     * InFlight() until they end.
+     */
+    SpanToken BeginSpan();
+
+    /**
+     * End a span: counts one sample at the end time and records the
+     * span's latency (if enabled), from a single clock read
+     */
+    void EndSpan(const SpanToken& token);
+
+    /// Number of spans begun but not yet ended
+    int64_t InFlight() const { return m_spans.InFlight(); }
+
+    /// Start recording span latencies (windowed, ~6% accurate)
+    void EnableSpanLatency(
+          float max_window_seconds = 10.f,
+          std::size_t slices = 20);
+
+    /**
+     * Latency quantile (seconds) of the spans that ended within the past
+     * "window_seconds", or a negative value if there are none or span
+     * latencies are not recorded
+     */
+    float SpanLatency(
+          float window_seconds,
+          float quantile = 0.5f);
+    
+    /** 
+     * Estimate FPS over a given window. Larger choices of the argument 
+     * "window_seconds" will lead to more stable estimates, but may smooth 
+     * out (and thus lose) high frequency changes in the FPS rate.
+     *
+     * FPS() takes no lock. It scans a snapshot of the sample ring, so it
+     * neither blocks nor is blocked by concurrent AddSample() calls.
+     * 
+     * @param window_seconds Number of past seconds over which to measure
+     * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
+     * 
+     * @returns an estimate of the rate with which new samples are currently 
+     *          arriving, computed over a past time window of "window_seconds" 
+     *          seconds (starting now). If there is not enough data available, 
+     *          a negative value is returned.
+     */
+    float FPS(
+          float window_seconds = 1.f,
+          bool soft_estimate = false,
+          EstimationMethod method = CountSamples);
+
+    /**
+     * Sum of sample weights per second over the past "window_seconds"
+     * (e.g. bytes/sec when the weights are byte counts). Uses the same
+     * lock-free window scan as FPS(..., CountSamples).
+     *
+     * @returns the rate, or a negative value if there is not enough data
+     */
+    float Throughput(
+          float window_seconds = 1.f);
+
+    /**
+     * Estimate FPS over several windows at once. All windows are served
+     * by a single backward pass over the samples, so the cost is that of
+     * the longest window alone. The rolling weighted average (see
+     * "soft_estimate") is not affected.
+     *
+     * @param windows_begin First window length in seconds (any order)
+     * @param windows_end One past the last window length
+     * @param results Receives one estimate per window, in input order;
+     *                negative where there is not enough data
+     * @param method Estimation method, as for the single-window FPS()
+     */
+    void FPS(
+          const float* windows_begin,
+          const float* windows_end,
+          float* results,
+          EstimationMethod method = CountSamples);
+
+    /// Estimate FPS over several windows (e.g. "FPS({0.5f, 1.f, 5.f})")
+    std::vector<float> FPS(
+          std::initializer_list<float> windows,
+          EstimationMethod method = CountSamples);
+
+    /**
+     * Start feeding samples into a RateRollup (seconds/minutes/hours), so
+     * that RollupFPS() can answer windows far beyond the ring capacity.
+     * Costs one extra counter update per sample. Call this before
+     * samples are added concurrently; later calls have no effect.
+     */
+    void EnableRollups();
+
+    /**
+     * Estimate FPS over a (long) window from the rollups. Accuracy at the
+     * oldest end of the window is that of the coarsest level involved.
+     *
+     * @param window_seconds Number of past seconds over which to measure
+     *
+     * @returns the estimated rate, or a negative value if rollups are not
+     *          enabled, have not been running for "window_seconds" yet,
+     *          or the window exceeds their horizon
+     */
+    float RollupFPS(
+          float window_seconds);
+
+    /**
+     * Start keeping a windowed histogram of the intervals between
+     * consecutive samples (an IntervalHistogram), updated in O(1) per
+     * sample. Needed by IntervalPercentiles() and LowFPS(). Call this
+     * before samples are added concurrently; later calls have no effect.
+     *
+     * @param max_window_seconds Longest window that can be queried
+     * @param slices Time slices per window; queried windows are rounded
+     *               up to whole slices
+     */
+    void EnableIntervalHistogram(
+          float max_window_seconds = 10.f,
+          std::size_t slices = 20);
+
+    /**
+     * Percentiles of the intervals between samples (frame times) over
+     * the past "window_seconds", e.g. {0.5f, 0.99f, 0.999f}. Accurate to
+     * ~6% of each value.
+     *
+     * @param results Receives one interval in seconds per quantile;
+     *                negative if the histogram is not enabled or empty
+     */
+    void IntervalPercentiles(
+          float window_seconds,
+          const float* quantiles_begin,
+          const float* quantiles_end,
+          float* results);
+
+    /// Single-quantile version of IntervalPercentiles()
+    float IntervalPercentile(
+          float window_seconds,
+          float quantile);
+
+    /**
+     * "1% low" style FPS: the rate corresponding to the mean of the
+     * longest "fraction" of intervals over the past "window_seconds".
+     *
+     * @returns the rate, or a negative value if the histogram is not
+     *          enabled or empty
+     */
+    float LowFPS(
+          float window_seconds,
+          float fraction = 0.01f);
+
+    /**
+     * Start keeping a mergeable sketch of all intervals between
+     * consecutive samples (an IntervalSketch) with relative error
+     * "relative_accuracy". Call this before samples are added
+     * concurrently; later calls have no effect.
+     */
+    void EnableIntervalSketch(
+          double relative_accuracy = 0.01,
+          double max_seconds = 3600.);
+
+    /**
+     * Snapshot of the interval sketch, e.g. to Merge() the sketches of
+     * several estimators into one distribution
+     *
+     * @throws std::logic_error if the sketch is not enabled
+     */
+    IntervalSketch IntervalDistribution() const;
+
+    /**
+     * Start keeping a continuous-time exponentially decaying rate (a
+     * DecayingRate) with time constant "tau_seconds". Unlike the rolling
+     * average of "soft_estimate", it is updated in O(1) per sample and
+     * decayed analytically when read, so it does not depend on how
+     * often FPS() is polled and needs no sample history. Call this
+     * before samples are added concurrently; later calls have no effect.
+     */
+    void EnableDecayingRate(
+          float tau_seconds = 1.f);
+
+    /**
+     * @returns the exponentially decaying rate, or a negative value if
+     *          it is not enabled
+     */
+    float DecayingFPS();
+
+    /**
+     * Start flagging hitches (stalls) as samples arrive, see
+     * HitchDetector. This replaces polling FPS() every frame just to
+     * notice stalls. Call this before samples are added concurrently;
+     * later calls have no effect.
+     *
+     * @param median_factor Intervals longer than this many running
+     *                      medians are hitches; 0 disables the check
+     * @param budget_seconds Intervals longer than this are hitches;
+     *                       0 disables the check
+     * @param capacity Number of hitches kept for Hitches()
+     * @param callback Called on the adding thread for every hitch
+     */
+    void EnableHitchDetection(
+          float median_factor = 3.f,
+          float budget_seconds = 0.f,
+          std::size_t capacity = 64,
+          const HitchDetector::Callback& callback = HitchDetector::Callback());
+
+    /**
+     * Copy the most recent hitches, oldest first
+     *
+     * @returns the number of hitches since enabled or Reset() (0 if
+     *          hitch detection is not enabled)
+     */
+    uint64_t Hitches(
+          std::vector<Hitch>& hitches) const;
+
+    /**
+     * Start testing the arrival stream for rate changes as samples
+     * arrive, see RateChangeDetector. Call this before samples are added
+     * concurrently; later calls have no effect.
+     *
+     * @param sensitivity Relative rate shift the test is tuned to detect
+     * @param threshold Evidence (log-likelihood ratio) needed for a change
+     * @param warm_up Intervals used to measure the initial baseline
+     * @param callback Called on the adding thread for every change
+     */
+    void EnableRateChangeDetection(
+          float sensitivity = 0.5f,
+          float threshold = 12.f,
+          uint32_t warm_up = 64,
+          const RateChangeDetector::Callback& callback =
+              RateChangeDetector::Callback());
+
+    /**
+     * Most recent rate change
+     *
+     * @returns the number of changes since enabled or Reset() (0 if
+     *          change detection is not enabled)
+     */
+    uint64_t LastRateChange(
+          RateChange& change) const;
+        
+    /// Reset the instance
+    void Reset();
+    
+  private:
+    
+    /// Fold a new estimate into the rolling weighted average
+    float UpdateRolling(float estimate);
+
+    /// Discard expired samples if a compaction is due at tick "now"
+    void MaybeCompact(int64_t now);
+
+    /// Feed "count" samples at "ticks" into the optional components
+    void Observe(int64_t ticks, std::size_t count);
+    
+    SampleRing m_sample_times;
+
+    /// Optional components (NULL until enabled)
+    std::atomic<RateRollup*> m_rollup;
+    std::atomic<int64_t> m_rollup_start;
+    std::atomic<IntervalHistogram*> m_interval_histogram;
+    std::atomic<IntervalSketch*> m_interval_sketch;
+    std::atomic<DecayingRate*> m_decaying_rate;
+    std::atomic<HitchDetector*> m_hitch_detector;
+    std::atomic<RateChangeDetector*> m_change_detector;
+
+    SpanStats m_spans;
+
+    /// Time of the newest sample, for inter-sample intervals
+    std::atomic<int64_t> m_last_sample;
+
+    std::atomic<int64_t> m_retention;
+    std::atomic<int64_t> m_last_compaction;
+
+    std::atomic<float> m_rolling;
+    std::atomic<float> m_decay_factor;
+    
+    #ifdef DEBUG_MODE
+      TIME_POINT_T m_debug_start_time;
+    #endif
+  };
+
+  typedef BasicFPSEstimator<> FPSEstimator;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicFPSEstimator class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicFPSEstimator<ClockT>::BasicFPSEstimator(std::size_t capacity)
+  : m_sample_times(capacity),
+    m_rollup(NULL),
+    m_rollup_start(INT64_MAX),
+    m_interval_histogram(NULL),
+    m_interval_sketch(NULL),
+    m_decaying_rate(NULL),
+    m_hitch_detector(NULL),
+    m_change_detector(NULL),
+    m_last_sample(INT64_MIN),
+    m_retention(0),
+    m_last_compaction(0),
+    m_rolling(0.f),
+    m_decay_factor(0.f)
+  { 
+    #ifdef DEBUG_MODE
+      m_debug_start_time = ClockT::Now();
+    #endif
+  }
+
+  /// Destructor
+  template <typename ClockT>
+  BasicFPSEstimator<ClockT>::~BasicFPSEstimator()
+  {
+    delete m_rollup.load();
+    delete m_interval_histogram.load();
+    delete m_interval_sketch.load();
+    delete m_decaying_rate.load();
+    delete m_hitch_detector.load();
+    delete m_change_detector.load();
+  }
+
+  /**
+   * Set decay factor
+   *
+   * @param new_decay_factor The new decay factor
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::SetDecayFactor(float new_decay_factor)
+  {
+    m_decay_factor.store(new_decay_factor, std::memory_order_relaxed);
+  }
+
+  /**
+   * Fold a new estimate into the rolling weighted average. Concurrent
+   * FPS() calls may race on this; each one's estimate is applied once.
+   *
+   * @param estimate The newest (unsmoothed) estimate
+   *
+   * @returns the updated rolling weighted average
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::UpdateRolling(float estimate)
+  {
+    const float decay_factor = m_decay_factor.load(std::memory_order_relaxed);
+    float rolling = m_rolling.load(std::memory_order_relaxed);
+    float updated;
+    do {
+      updated =      decay_factor  * rolling +
+                (1.f-decay_factor) * estimate;
+    } while (!m_rolling.compare_exchange_weak(rolling, updated,
+                                              std::memory_order_relaxed));
+    return updated;
+  }
+  
+  /**
+   * Set the retention window
+   *
+   * @param max_retention_seconds Longest window that FPS() needs to answer
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::SetRetention(float max_retention_seconds)
+  {
+    m_retention.store(SecondsToTicks(max_retention_seconds),
+                      std::memory_order_relaxed);
+  }
+
+  /**
+   * Discard expired samples if a compaction is due. Only the producer
+   * that wins the race for "m_last_compaction" does the work.
+   *
+   * @param now Tick of the sample that is being added
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::MaybeCompact(int64_t now)
+  {
+    const int64_t retention = m_retention.load(std::memory_order_relaxed);
+    if (retention <= 0)
+      return;
+    int64_t last = m_last_compaction.load(std::memory_order_relaxed);
+    if (now-last < retention/4 ||
+        !m_last_compaction.compare_exchange_strong(last, now,
+                                                   std::memory_order_relaxed))
+      return;
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Discarding samples older than "
+                << retention << "ns\n";
+    #endif
+    m_sample_times.DiscardUpTo(now-retention);
+  }
+
+  /**
+   * Feed samples into the optional components
+   *
+   * @param ticks Time point of the samples
+   * @param count Number of samples at that time point
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::Observe(int64_t ticks, std::size_t count)
+  {
+    RateRollup* rollup = m_rollup.load(std::memory_order_acquire);
+    if (rollup) {
+      rollup->Add(ticks, static_cast<uint32_t>(count));
+      StoreMinimum(m_rollup_start, ticks);
+    }
+
+    DecayingRate* decaying = m_decaying_rate.load(std::memory_order_acquire);
+    if (decaying)
+      decaying->Add(ticks, count);
+
+    IntervalHistogram* histogram =
+        m_interval_histogram.load(std::memory_order_acquire);
+    IntervalSketch* sketch = m_interval_sketch.load(std::memory_order_acquire);
+    HitchDetector* hitches = m_hitch_detector.load(std::memory_order_acquire);
+    RateChangeDetector* changes =
+        m_change_detector.load(std::memory_order_acquire);
+    if (histogram || sketch || hitches || changes) {
+      const int64_t previous = m_last_sample.exchange(
+                                   ticks, std::memory_order_relaxed);
+      /// Skip the very first sample and out-of-order samples
+      const bool has_interval = previous != INT64_MIN && previous <= ticks;
+      if (histogram) {
+        if (has_interval)
+          histogram->Add(ticks, ticks-previous);
+        if (count > 1)
+          histogram->Add(ticks, 0, static_cast<uint32_t>(count-1));
+      }
+      if (sketch) {
+        if (has_interval)
+          sketch->Add(ticks-previous);
+        if (count > 1)
+          sketch->Add(0, count-1);
+      }
+      if (hitches && has_interval)
+        hitches->Add(ticks, ticks-previous);
+      /// Without an interval there is no time span to measure a batch by
+      if (changes && has_interval)
+        changes->Add(ticks, ticks-previous, count);
+    }
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::AddSample()
+  {
+    AddSample(ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::AddSample(const TIME_POINT_T& when)
+  {
+    const int64_t ticks = TicksSinceEpoch(when);
+    m_sample_times.Push(when);
+    MaybeCompact(ticks);
+    Observe(ticks, 1);
+    
+    #ifdef DEBUG_MODE
+      float elapsed = NanosecondsBetween(when, m_debug_start_time);
+      std::cout << "FPSEstimator: New sample stored ("
+                << elapsed << "us)\n";
+    #endif
+  }
+
+  /// Add a weighted sample
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::AddSample(double weight)
+  {
+    AddSample(ClockT::Now(), weight);
+  }
+
+  /// Add a weighted sample with an externally measured time point
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::AddSample(const TIME_POINT_T& when,
+                                            double weight)
+  {
+    const int64_t ticks = TicksSinceEpoch(when);
+    m_sample_times.Push(when, weight);
+    MaybeCompact(ticks);
+    Observe(ticks, 1);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: New sample of weight " << weight
+                << " stored\n";
+    #endif
+  }
+
+  /// Start timing a span
+  template <typename ClockT>
+  SpanToken BasicFPSEstimator<ClockT>::BeginSpan()
+  {
+    m_spans.Begin();
+    SpanToken token = { ClockT::Now() };
+    return token;
+  }
+
+  /// End a span
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EndSpan(const SpanToken& token)
+  {
+    const TIME_POINT_T now = ClockT::Now();
+    AddSample(now);
+    m_spans.End(TicksSinceEpoch(now), TicksSinceEpoch(token.started));
+  }
+
+  /**
+   * Start recording span latencies
+   *
+   * @param max_window_seconds Longest window that can be queried
+   * @param slices Time slices per window
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableSpanLatency(
+        float max_window_seconds,
+        std::size_t slices)
+  {
+    m_spans.EnableLatency(max_window_seconds, slices);
+  }
+
+  /**
+   * Latency quantile of recently ended spans
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param quantile Quantile (0..1)
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::SpanLatency(float window_seconds,
+                                               float quantile)
+  {
+    return m_spans.Latency(TicksSinceEpoch(ClockT::Now()), window_seconds,
+                           quantile);
+  }
+
+  /// Add a batch of samples
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::AddSamples(const TIME_POINT_T* begin,
+                                             const TIME_POINT_T* end)
+  {
+    if (begin == end)
+      return;
+    m_sample_times.Push(begin, end);
+    MaybeCompact(TicksSinceEpoch(*(end-1)));
+    for (const TIME_POINT_T* sample = begin; sample != end; ++sample)
+      Observe(TicksSinceEpoch(*sample), 1);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: " << (end-begin) << " new samples stored\n";
+    #endif
+  }
+
+  /// Add "count" samples that all happened at "when"
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::AddSamples(std::size_t count,
+                                             const TIME_POINT_T& when)
+  {
+    if (count == 0)
+      return;
+    const int64_t ticks = TicksSinceEpoch(when);
+    m_sample_times.Push(count, when);
+    MaybeCompact(ticks);
+    Observe(ticks, count);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: " << count << " new samples stored\n";
+    #endif
+  }
+  
+  /** 
+   * Estimate FPS over a given window. Larger choices of the argument 
+   * "window_seconds" will lead to more stable estimates, but may smooth 
+   * out (and thus lose) high frequency changes in the FPS rate.
+   * 
+   * @param window_seconds Number of past seconds over which to measure
+   * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
+   * 
+   * @returns an estimate of the rate with which new samples are currently 
+   *          arriving, computed over a past time window of "window_seconds" 
+   *          seconds (starting now). If there is not enough data available, 
+   *          a negative value is returned.
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::FPS(float window_seconds,
+                                       bool soft_estimate,
+                                       EstimationMethod method)
+  {
+    switch (method) {
+    
+      case CountSamples: {
+        #ifdef DEBUG_MODE
+          std::ostringstream oss;
+          oss << "FPSEstimator: Sampling.. ( ";
+        #endif
+
+        uint64_t samples = 0;
+        bool window_filled = false;
+        uint64_t ticket = 0;
+        const int64_t now = TicksSinceEpoch(ClockT::Now());
+        /// Samples at or before this tick are outside the window
+        const int64_t cutoff = now - SecondsToTicks(window_seconds);
+        {
+          /// Lock-free snapshot: producers keep appending behind "Head()"
+          const uint64_t oldest = m_sample_times.Oldest();
+          ticket = m_sample_times.Head();
+          while (ticket > oldest) {
+            --ticket;
+            int64_t sample;
+            /// Skip samples that are still being written
+            if (!m_sample_times.Read(ticket, sample))
+              continue;
+            if (sample <= cutoff) {
+              window_filled = (ticket > oldest);
+              break;
+            }
+            #ifdef DEBUG_MODE
+              oss << (now-sample) << "ns ";
+            #endif
+            ++samples;
+          }
+        }
+        
+        #ifdef DEBUG_MODE
+          oss << ")";
+        #endif
+
+        /// If no older sample was found, there were not enough samples to fill the time window
+        if (!window_filled)
+          return -1.f;
+        
+        /** 
+         * We have an integer estimate, but we want to be more informative. 
+         * Let's compute an estimate for the mission fraction.
+         *
+         *    window_seconds*1e6-NsB(now,i+1)
+         *              ╭──┴─╮
+         *              │╭NsB(now,i)-NsB(now,i-1)           
+         *           ╭───┴───╮                              
+         *  o    o   o  [    o      o  o      o       o     ]  ◀◀ Samples
+         *  0   i-1  i  │   i+1                   size()-1  │
+         *           │  ╰────────────────┬──────────────────╯
+         *           │       │    window_seconds*1e6)       │
+         *           │       ╰────────────────┬─────────────╯
+         *           │                  NsB(now,i+1)        │
+         *           ╰────────────────────────┬─────────────╯
+         *                              NsB(now,i)
+         *
+         *  >>>>>>>>>>>>│>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>│  ◀◀ Timeline
+         *    "window_seconds" ago                         Now
+         *
+         *  Old samples (indices 0 to i-1) are evicted by the ring buffer,
+         *  or discarded once they leave the retention window.
+         */
+        
+        #ifdef DEBUG_MODE
+          oss << "\n";
+          std::cout << oss.str();
+        #endif
+
+        /// Adjust the rolling weighted average estimate
+        const float fps_estimate = static_cast<float>(samples)/window_seconds;
+        const float rolling = UpdateRolling(fps_estimate);
+          
+        if (soft_estimate)
+          return rolling;
+        else
+          return fps_estimate;
+      }
+
+      case AverageIntervals: {
+        int samples = 0;
+        bool window_filled = false;
+        bool have_youngest = false;
+        uint64_t ticket = 0;
+        const int64_t now = TicksSinceEpoch(ClockT::Now());
+        /// Samples at or before this tick are outside the window
+        const int64_t cutoff = now - SecondsToTicks(window_seconds);
+        int64_t youngest_sample = 0;
+        int64_t oldest_sample = 0;
+        
+        #ifdef DEBUG_MODE
+          std::ostringstream oss;
+          oss << "FPSEstimator: Passing samples: (";
+        #endif
+          
+        {
+          /// Lock-free snapshot: producers keep appending behind "Head()"
+          const uint64_t oldest = m_sample_times.Oldest();
+          ticket = m_sample_times.Head();
+          while (ticket > oldest) {
+            --ticket;
+            int64_t sample;
+            /// Skip samples that are still being written
+            if (!m_sample_times.Read(ticket, sample))
+              continue;
+            if (!have_youngest) {
+              youngest_sample = sample;
+              have_youngest = true;
+            }
+            if (sample <= cutoff) {
+              oldest_sample = sample;
+              window_filled = true;
+              break;
+            }
+            #ifdef DEBUG_MODE
+              oss << (now-sample) << "ns ";
+            #endif
+            ++samples;
+          }
+        }
+        
+        #ifdef DEBUG_MODE
+          oss << ") = " << samples << " samples, youngest sample="
+              << (now-youngest_sample)
+              << "ns\n";
+        #endif
+
+        /// If no older sample was found, there were not enough samples to fill the time window
+        if (!window_filled)
+          return -1.f;
+
+        const double average_interval = static_cast<double>(
+                                            youngest_sample-oldest_sample) /
+                                        samples;
+        const float fps_estimate = static_cast<float>(1e9 / average_interval);
+
+        #ifdef DEBUG_MODE
+          oss << "Interval=" << (now-oldest_sample)
+              << "ns => " << (now-youngest_sample)
+              << "ns is " << (youngest_sample-oldest_sample)
+              << "ns => average over " << samples << " intervals is "
+              << average_interval << "ns\n";
+        #endif
+        
+        #ifdef DEBUG_MODE
+          std::cout << oss.str();
+        #endif
+
+        /// Adjust the rolling weighted average estimate
+        const float rolling = UpdateRolling(fps_estimate);
+          
+        if (soft_estimate)
+          return rolling;
+        else
+          return fps_estimate;
+      }
+
+      default: {
+        throw std::runtime_error("FPSEstimator: Unknown value for 'method'");
+      }
+    }
+  }
+  
+  /**
+   * Sum of sample weights per second over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::Throughput(float window_seconds)
+  {
+    double weights = 0.;
+    bool window_filled = false;
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    /// Samples at or before this tick are outside the window
+    const int64_t cutoff = now - SecondsToTicks(window_seconds);
+    {
+      /// Lock-free snapshot: producers keep appending behind "Head()"
+      const uint64_t oldest = m_sample_times.Oldest();
+      uint64_t ticket = m_sample_times.Head();
+      while (ticket > oldest) {
+        --ticket;
+        int64_t sample;
+        double weight;
+        /// Skip samples that are still being written
+        if (!m_sample_times.Read(ticket, sample, weight))
+          continue;
+        if (sample <= cutoff) {
+          window_filled = (ticket > oldest);
+          break;
+        }
+        weights += weight;
+      }
+    }
+
+    /// If no older sample was found, there were not enough samples to fill the time window
+    if (!window_filled)
+      return -1.f;
+    return static_cast<float>(weights / window_seconds);
+  }
+
+  /**
+   * Estimate FPS over several windows in a single pass
+   *
+   * @param windows_begin First window length in seconds (any order)
+   * @param windows_end One past the last window length
+   * @param results Receives one estimate per window, in input order
+   * @param method Estimation method, as for the single-window FPS()
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::FPS(const float* windows_begin,
+                                      const float* windows_end,
+                                      float* results,
+                                      EstimationMethod method)
+  {
+    if (method != CountSamples && method != AverageIntervals)
+      throw std::runtime_error("FPSEstimator: Unknown value for 'method'");
+
+    const std::size_t windows = windows_end-windows_begin;
+    if (windows == 0)
+      return;
+
+    /// Visit the windows from shortest to longest (insertion sort)
+    std::vector<std::size_t> order(windows);
+    for (std::size_t w = 0; w < windows; ++w) {
+      std::size_t position = w;
+      while (position > 0 &&
+             windows_begin[order[position-1]] > windows_begin[w]) {
+        order[position] = order[position-1];
+        --position;
+      }
+      order[position] = w;
+      results[w] = -1.f;
+    }
+
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    uint64_t samples = 0;
+    bool have_youngest = false;
+    int64_t youngest_sample = 0;
+    std::size_t current = 0;
+    int64_t cutoff = now - SecondsToTicks(windows_begin[order[current]]);
+
+    /// Lock-free snapshot, exactly as in the single-window FPS()
+    const uint64_t oldest = m_sample_times.Oldest();
+    uint64_t ticket = m_sample_times.Head();
+    while (ticket > oldest && current < windows) {
+      --ticket;
+      int64_t sample;
+      /// Skip samples that are still being written
+      if (!m_sample_times.Read(ticket, sample))
+        continue;
+      if (!have_youngest) {
+        youngest_sample = sample;
+        have_youngest = true;
+      }
+      /// This sample closes every window whose cutoff it lies beyond
+      while (sample <= cutoff) {
+        const std::size_t w = order[current];
+        if (method == CountSamples) {
+          if (ticket > oldest)
+            results[w] = static_cast<float>(samples) / windows_begin[w];
+        } else {
+          results[w] = static_cast<float>(
+                           1e9 * samples / (youngest_sample-sample));
+        }
+        if (++current == windows)
+          break;
+        cutoff = now - SecondsToTicks(windows_begin[order[current]]);
+      }
+      ++samples;
+    }
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: " << windows << " windows from "
+                << samples << " samples\n";
+    #endif
+  }
+
+  /// Estimate FPS over several windows in a single pass
+  template <typename ClockT>
+  std::vector<float> BasicFPSEstimator<ClockT>::FPS(
+        std::initializer_list<float> windows,
+        EstimationMethod method)
+  {
+    std::vector<float> results(windows.size());
+    FPS(windows.begin(), windows.end(), results.data(), method);
+    return results;
+  }
+  
+  /// Start feeding samples into rollups
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableRollups()
+  {
+    if (!m_rollup.load(std::memory_order_acquire))
+      InstallOnce(m_rollup, new RateRollup());
+  }
+
+  /**
+   * Estimate FPS over a (long) window from the rollups
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::RollupFPS(float window_seconds)
+  {
+    const RateRollup* rollup = m_rollup.load(std::memory_order_acquire);
+    if (!rollup)
+      return -1.f;
+
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (window > rollup->Horizon() ||
+        m_rollup_start.load(std::memory_order_relaxed) > now-window)
+      return -1.f;
+
+    return static_cast<float>(rollup->Sum(now-window, now) / window_seconds);
+  }
+  
+  /**
+   * Start keeping a windowed histogram of inter-sample intervals
+   *
+   * @param max_window_seconds Longest window that can be queried
+   * @param slices Time slices per window
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableIntervalHistogram(
+        float max_window_seconds,
+        std::size_t slices)
+  {
+    if (!m_interval_histogram.load(std::memory_order_acquire))
+      InstallOnce(m_interval_histogram,
+                  new IntervalHistogram(max_window_seconds, slices));
+  }
+
+  /**
+   * Percentiles of the inter-sample intervals over a window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param quantiles_begin First quantile (0..1)
+   * @param quantiles_end One past the last quantile
+   * @param results Receives one interval in seconds per quantile
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::IntervalPercentiles(
+        float window_seconds,
+        const float* quantiles_begin,
+        const float* quantiles_end,
+        float* results)
+  {
+    const IntervalHistogram* histogram =
+        m_interval_histogram.load(std::memory_order_acquire);
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    if (histogram) {
+      const int64_t now = TicksSinceEpoch(ClockT::Now());
+      total = histogram->Merge(now-SecondsToTicks(window_seconds), now,
+                               counts);
+    }
+    for (; quantiles_begin != quantiles_end; ++quantiles_begin, ++results) {
+      if (total == 0)
+        *results = -1.f;
+      else
+        *results = static_cast<float>(IntervalHistogram::Quantile(
+                       counts, total, *quantiles_begin) * 1e-9);
+    }
+  }
+
+  /**
+   * Single percentile of the inter-sample intervals over a window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param quantile Quantile (0..1)
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::IntervalPercentile(float window_seconds,
+                                                      float quantile)
+  {
+    float result;
+    IntervalPercentiles(window_seconds, &quantile, &quantile+1, &result);
+    return result;
+  }
+
+  /**
+   * Rate implied by the longest intervals over a window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param fraction Fraction of the longest intervals to average
+   */
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::LowFPS(float window_seconds,
+                                          float fraction)
+  {
+    const IntervalHistogram* histogram =
+        m_interval_histogram.load(std::memory_order_acquire);
+    if (!histogram)
+      return -1.f;
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    std::vector<uint64_t> counts;
+    const uint64_t total = histogram->Merge(
+                               now-SecondsToTicks(window_seconds), now, counts);
+    if (total == 0)
+      return -1.f;
+    const double mean = IntervalHistogram::TailMean(counts, total, fraction);
+    return (mean > 0.) ? static_cast<float>(1e9 / mean) : -1.f;
+  }
+
+  /**
+   * Start keeping a mergeable sketch of inter-sample intervals
+   *
+   * @param relative_accuracy Relative error of quantiles
+   * @param max_seconds Longest interval resolved by the sketch
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableIntervalSketch(
+        double relative_accuracy,
+        double max_seconds)
+  {
+    if (!m_interval_sketch.load(std::memory_order_acquire))
+      InstallOnce(m_interval_sketch,
+                  new IntervalSketch(relative_accuracy, max_seconds));
+  }
+
+  /// Snapshot of the interval sketch
+  template <typename ClockT>
+  IntervalSketch BasicFPSEstimator<ClockT>::IntervalDistribution() const
+  {
+    const IntervalSketch* sketch =
+        m_interval_sketch.load(std::memory_order_acquire);
+    if (!sketch)
+      throw std::logic_error("FPSEstimator: Interval sketch not enabled");
+    return *sketch;
+  }
+
+  /**
+   * Start keeping a continuous-time exponentially decaying rate
+   *
+   * @param tau_seconds Time constant of the decay
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableDecayingRate(float tau_seconds)
+  {
+    if (m_decaying_rate.load(std::memory_order_acquire))
+      return;
+    DecayingRate* decaying = new DecayingRate(tau_seconds);
+    decaying->Clear(TicksSinceEpoch(ClockT::Now()));
+    InstallOnce(m_decaying_rate, decaying);
+  }
+
+  /// Exponentially decaying rate
+  template <typename ClockT>
+  float BasicFPSEstimator<ClockT>::DecayingFPS()
+  {
+    const DecayingRate* decaying =
+        m_decaying_rate.load(std::memory_order_acquire);
+    if (!decaying)
+      return -1.f;
+    return static_cast<float>(decaying->Rate(TicksSinceEpoch(ClockT::Now())));
+  }
+
+  /**
+   * Start flagging hitches as samples arrive
+   *
+   * @param median_factor Threshold in running medians (0 = off)
+   * @param budget_seconds Absolute threshold (0 = off)
+   * @param capacity Number of hitches kept
+   * @param callback Called for every hitch
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableHitchDetection(
+        float median_factor,
+        float budget_seconds,
+        std::size_t capacity,
+        const HitchDetector::Callback& callback)
+  {
+    if (!m_hitch_detector.load(std::memory_order_acquire))
+      InstallOnce(m_hitch_detector,
+                  new HitchDetector(median_factor, budget_seconds,
+                                    capacity, callback));
+  }
+
+  /// Copy the most recent hitches
+  template <typename ClockT>
+  uint64_t BasicFPSEstimator<ClockT>::Hitches(
+        std::vector<Hitch>& hitches) const
+  {
+    const HitchDetector* detector =
+        m_hitch_detector.load(std::memory_order_acquire);
+    if (!detector) {
+      hitches.clear();
+      return 0;
+    }
+    return detector->Hitches(hitches);
+  }
+
+  /**
+   * Start testing the arrival stream for rate changes
+   *
+   * @param sensitivity Relative rate shift to detect
+   * @param threshold Evidence needed for a change
+   * @param warm_up Intervals used to measure the initial baseline
+   * @param callback Called for every change
+   */
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::EnableRateChangeDetection(
+        float sensitivity,
+        float threshold,
+        uint32_t warm_up,
+        const RateChangeDetector::Callback& callback)
+  {
+    if (!m_change_detector.load(std::memory_order_acquire))
+      InstallOnce(m_change_detector,
+                  new RateChangeDetector(sensitivity, threshold, warm_up,
+                                         callback));
+  }
+
+  /// Most recent rate change
+  template <typename ClockT>
+  uint64_t BasicFPSEstimator<ClockT>::LastRateChange(
+        RateChange& change) const
+  {
+    const RateChangeDetector* detector =
+        m_change_detector.load(std::memory_order_acquire);
+    return detector ? detector->LastChange(change) : 0;
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicFPSEstimator<ClockT>::Reset()
+  {
+    m_sample_times.Clear();
+    m_last_compaction.store(0, std::memory_order_relaxed);
+    RateRollup* rollup = m_rollup.load(std::memory_order_acquire);
+    if (rollup)
+      rollup->Clear();
+    m_rollup_start.store(INT64_MAX, std::memory_order_relaxed);
+    IntervalHistogram* histogram =
+        m_interval_histogram.load(std::memory_order_acquire);
+    if (histogram)
+      histogram->Clear();
+    IntervalSketch* sketch = m_interval_sketch.load(std::memory_order_acquire);
+    if (sketch)
+      sketch->Clear();
+    DecayingRate* decaying = m_decaying_rate.load(std::memory_order_acquire);
+    if (decaying)
+      decaying->Clear(TicksSinceEpoch(ClockT::Now()));
+    HitchDetector* hitches = m_hitch_detector.load(std::memory_order_acquire);
+    if (hitches)
+      hitches->Clear();
+    RateChangeDetector* changes =
+        m_change_detector.load(std::memory_order_acquire);
+    if (changes)
+      changes->Clear();
+    m_last_sample.store(INT64_MIN, std::memory_order_relaxed);
+    m_spans.Clear();
+    
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+      m_debug_start_time = ClockT::Now();
+    #endif
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicBucketedFPSEstimator class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Counterpart to FPSEstimator that does not store individual samples.
+   * Events are counted in the buckets of a CounterWheel instead, so
+   * AddSample() is a single counter increment, memory does not depend on
+   * the event rate, and FPS() sums a bounded number of buckets. The price
+   * is a time resolution of one bucket width at the oldest end of the
+   * window, and a maximum window length fixed at construction.
+   *
+   * Estimators can be arranged in a tree with AddChild(), e.g. endpoint
+   * estimators under a service estimator under a global one. A sample
+   * is only added to the estimator where it happens; FPS() of a parent
+   * sums its own buckets and those of all its descendants at query time.
+   */
+  template <typename ClockT = SteadyClock>
+  class BasicBucketedFPSEstimator {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param bucket_width Time span counted by one bucket
+     * @param max_window_seconds Longest window that FPS() can be asked for
+     */
+    BasicBucketedFPSEstimator(
+          TIME_RESOLUTION_T bucket_width = std::chrono::milliseconds(1),
+          float max_window_seconds = 10.f);
+
+    /// Destructor
+    ~BasicBucketedFPSEstimator() { }
+
+    /// Set decay factor
+    void SetDecayFactor(
+          float new_decay_factor = 0.f);
+
+    /// Add a sample
+    void AddSample();
+
+    /// Add a sample with an externally measured time point
+    void AddSample(const TIME_POINT_T& when);
+
+    /// Add a batch of samples (one counter update per bucket touched)
+    void AddSamples(const TIME_POINT_T* begin, const TIME_POINT_T* end);
+
+    /// Add "count" samples that all happened at "when"
+    void AddSamples(std::size_t count, const TIME_POINT_T& when);
+
+    /// Span tracking, as in FPSEstimator::BeginSpan() and EndSpan()
+    SpanToken BeginSpan();
+    void EndSpan(const SpanToken& token);
+    int64_t InFlight() const { return m_spans.InFlight(); }
+    void EnableSpanLatency(
+          float max_window_seconds = 10.f,
+          std::size_t slices = 20);
+    float SpanLatency(
+          float window_seconds,
+          float quantile = 0.5f);
+
+    /**
+     * Estimate FPS over a given window (see FPSEstimator::FPS()).
+     *
+     * @param window_seconds Number of past seconds over which to measure
+     * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
+     *
+     * @returns the estimated rate, or a negative value if the estimator
+     *          has not been running for "window_seconds" yet or if the
+     *          window is longer than the maximum given at construction
+     */
+    float FPS(
+          float window_seconds = 1.f,
+          bool soft_estimate = false);
+
+    /**
+     * Include the samples of "child" (and of its descendants) in this
+     * estimator's FPS(). The child is not owned and must be removed
+     * before it is destroyed; its own FPS() is unaffected.
+     *
+     * @throws std::invalid_argument if this would create a cycle
+     */
+    void AddChild(
+          BasicBucketedFPSEstimator* child);
+
+    /// Stop including "child"; no effect if it is not a child
+    void RemoveChild(
+          BasicBucketedFPSEstimator* child);
+
+    /// Reset the instance (children are kept, and not reset)
+    void Reset();
+
+  private:
+
+    /// Sentinel for "no sample yet"
+    static const int64_t NO_SAMPLE = INT64_MAX;
+
+    /**
+     * Sum the samples of this subtree in (from, to], and find the
+     * subtree's first sample
+     *
+     * @returns the (fractional) count, negative if a wheel is too short
+     */
+    double SubtreeSum(int64_t from, int64_t to, int64_t& first_sample);
+
+    /// Whether "estimator" is this one or one of its descendants
+    bool Contains(const BasicBucketedFPSEstimator* estimator);
+
+    /// Serialises all tree edits, so that cycle checks stay valid
+    static std::mutex& TreeMutex();
+
+    std::vector<BasicBucketedFPSEstimator*> m_children;
+    std::mutex m_children__mutex;
+
+    CounterWheel m_wheel;
+    std::atomic<int64_t> m_first_sample;
+
+    SpanStats m_spans;
+
+    float m_rolling;
+    float m_decay_factor;
+  };
+
+  typedef BasicBucketedFPSEstimator<> BucketedFPSEstimator;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicBucketedFPSEstimator class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicBucketedFPSEstimator<ClockT>::BasicBucketedFPSEstimator(
+        TIME_RESOLUTION_T bucket_width,
+        float max_window_seconds)
+  : m_wheel(bucket_width, max_window_seconds),
+    m_first_sample(NO_SAMPLE),
+    m_rolling(0.f),
+    m_decay_factor(0.f)
+  { }
+
+  /**
+   * Set decay factor
+   *
+   * @param new_decay_factor The new decay factor
+   */
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::SetDecayFactor(
+        float new_decay_factor)
+  {
+    m_decay_factor = new_decay_factor;
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::AddSample()
+  {
+    AddSample(ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::AddSample(const TIME_POINT_T& when)
+  {
+    AddSamples(1, when);
+  }
+
+  /// Add a batch of samples
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::AddSamples(
+        const TIME_POINT_T* begin,
+        const TIME_POINT_T* end)
+  {
+    if (begin == end)
+      return;
+
+    /// Merge runs of samples that fall into the same bucket
+    const int64_t width = m_wheel.BucketWidth();
+    int64_t run_start = TicksSinceEpoch(*begin);
+    int64_t oldest = run_start;
+    uint32_t run_length = 0;
+    for (; begin != end; ++begin) {
+      const int64_t ticks = TicksSinceEpoch(*begin);
+      if (FloorDivide(ticks, width) != FloorDivide(run_start, width)) {
+        m_wheel.Add(run_start, run_length);
+        run_start = ticks;
+        run_length = 0;
+      }
+      if (ticks < oldest)
+        oldest = ticks;
+      ++run_length;
+    }
+    m_wheel.Add(run_start, run_length);
+    StoreMinimum(m_first_sample, oldest);
+  }
+
+  /// Add "count" samples that all happened at "when"
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::AddSamples(
+        std::size_t count,
+        const TIME_POINT_T& when)
+  {
+    if (count == 0)
+      return;
+    const int64_t ticks = TicksSinceEpoch(when);
+    m_wheel.Add(ticks, static_cast<uint32_t>(count));
+    StoreMinimum(m_first_sample, ticks);
+  }
+
+  /// Start timing a span
+  template <typename ClockT>
+  SpanToken BasicBucketedFPSEstimator<ClockT>::BeginSpan()
+  {
+    m_spans.Begin();
+    SpanToken token = { ClockT::Now() };
+    return token;
+  }
+
+  /// End a span
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::EndSpan(const SpanToken& token)
+  {
+    const TIME_POINT_T now = ClockT::Now();
+    AddSample(now);
+    m_spans.End(TicksSinceEpoch(now), TicksSinceEpoch(token.started));
+  }
+
+  /**
+   * Start recording span latencies
+   *
+   * @param max_window_seconds Longest window that can be queried
+   * @param slices Time slices per window
+   */
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::EnableSpanLatency(
+        float max_window_seconds,
+        std::size_t slices)
+  {
+    m_spans.EnableLatency(max_window_seconds, slices);
+  }
+
+  /**
+   * Latency quantile of recently ended spans
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param quantile Quantile (0..1)
+   */
+  template <typename ClockT>
+  float BasicBucketedFPSEstimator<ClockT>::SpanLatency(float window_seconds,
+                                                       float quantile)
+  {
+    return m_spans.Latency(TicksSinceEpoch(ClockT::Now()), window_seconds,
+                           quantile);
+  }
+
+  /**
+   * Estimate FPS over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
+   */
+  template <typename ClockT>
+  float BasicBucketedFPSEstimator<ClockT>::FPS(float window_seconds,
+                                               bool soft_estimate)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window_start = now - SecondsToTicks(window_seconds);
+
+    int64_t first_sample = NO_SAMPLE;
+    const double samples = SubtreeSum(window_start, now, first_sample);
+
+    /// Not enough data to fill the time window
+    if (samples < 0. || first_sample > window_start)
+      return -1.f;
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: " << samples << " samples in "
+                << window_seconds << "s\n";
+    #endif
+
+    const float fps_estimate = static_cast<float>(samples) / window_seconds;
+
+    /// Adjust the rolling weighted average estimate
+    m_rolling =      m_decay_factor  * m_rolling +
+                (1.f-m_decay_factor) * fps_estimate;
+
+    if (soft_estimate)
+      return m_rolling;
+    else
+      return fps_estimate;
+  }
+
+  /**
+   * Sum the samples of this subtree
+   *
+   * @param from Start of the range (exclusive)
+   * @param to End of the range (inclusive)
+   * @param first_sample Lowered to the subtree's first sample
+   */
+  template <typename ClockT>
+  double BasicBucketedFPSEstimator<ClockT>::SubtreeSum(int64_t from,
+                                                       int64_t to,
+                                                       int64_t& first_sample)
+  {
+    const int64_t own_first = m_first_sample.load(std::memory_order_relaxed);
+    if (own_first < first_sample)
+      first_sample = own_first;
+    double sum = m_wheel.Sum(from, to);
+    if (sum < 0.)
+      return -1.;
+
+    std::lock_guard<std::mutex> lock(m_children__mutex);
+    for (std::size_t i = 0; i < m_children.size(); ++i) {
+      const double child = m_children[i]->SubtreeSum(from, to, first_sample);
+      if (child < 0.)
+        return -1.;
+      sum += child;
+    }
+    return sum;
+  }
+
+  /// Whether an estimator is in this subtree
+  template <typename ClockT>
+  bool BasicBucketedFPSEstimator<ClockT>::Contains(
+        const BasicBucketedFPSEstimator* estimator)
+  {
+    if (estimator == this)
+      return true;
+    std::lock_guard<std::mutex> lock(m_children__mutex);
+    for (std::size_t i = 0; i < m_children.size(); ++i)
+      if (m_children[i]->Contains(estimator))
+        return true;
+    return false;
+  }
+
+  /// Lock shared by the tree edits of all estimators
+  template <typename ClockT>
+  std::mutex& BasicBucketedFPSEstimator<ClockT>::TreeMutex()
+  {
+    static std::mutex tree__mutex;
+    return tree__mutex;
+  }
+
+  /**
+   * Include a child's samples in FPS()
+   *
+   * @param child Estimator to include
+   */
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::AddChild(
+        BasicBucketedFPSEstimator* child)
+  {
+    std::lock_guard<std::mutex> tree_lock(TreeMutex());
+    if (!child || child->Contains(this))
+      throw std::invalid_argument("BucketedFPSEstimator: Child would "
+                                  "create a cycle");
+    std::lock_guard<std::mutex> lock(m_children__mutex);
+    if (std::find(m_children.begin(), m_children.end(), child) ==
+        m_children.end())
+      m_children.push_back(child);
+  }
+
+  /**
+   * Stop including a child's samples
+   *
+   * @param child Estimator to remove
+   */
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::RemoveChild(
+        BasicBucketedFPSEstimator* child)
+  {
+    std::lock_guard<std::mutex> tree_lock(TreeMutex());
+    std::lock_guard<std::mutex> lock(m_children__mutex);
+    m_children.erase(std::remove(m_children.begin(), m_children.end(), child),
+                     m_children.end());
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicBucketedFPSEstimator<ClockT>::Reset()
+  {
+    m_wheel.Clear();
+    m_first_sample.store(NO_SAMPLE, std::memory_order_relaxed);
+    m_spans.Clear();
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+    #endif
+  }
+
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicShardedFPSEstimator class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * BucketedFPSEstimator variant for many producer threads. Every thread
+   * counts into its own CounterWheel ("shard"), and the shards' buckets
+   * are only summed up when FPS() is queried. Since the wheels never
+   * share a cache line, producers on different shards never contend.
+   *
+   * Threads are assigned to shards round-robin on their first sample, so
+   * with at least as many shards as producer threads every producer has
+   * a shard to itself. More producers than shards is still correct, the
+   * threads sharing a shard merely contend on it.
+   */
+  template <typename ClockT = SteadyClock>
+  class BasicShardedFPSEstimator {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param shards Number of shards; 0 picks the hardware concurrency
+     * @param bucket_width Time span counted by one bucket
+     * @param max_window_seconds Longest window that FPS() can be asked for
+     */
+    explicit BasicShardedFPSEstimator(
+          std::size_t shards = 0,
+          TIME_RESOLUTION_T bucket_width = std::chrono::milliseconds(1),
+          float max_window_seconds = 10.f);
+
+    /// Destructor
+    ~BasicShardedFPSEstimator() { }
+
+    /// Set decay factor
+    void SetDecayFactor(
+          float new_decay_factor = 0.f);
+
+    /// Add a sample (to the calling thread's shard)
+    void AddSample();
+
+    /// Add a sample with an externally measured time point
+    void AddSample(const TIME_POINT_T& when);
+
+    /// Add a batch of samples (one counter update per bucket touched)
+    void AddSamples(const TIME_POINT_T* begin, const TIME_POINT_T* end);
+
+    /// Add "count" samples that all happened at "when"
+    void AddSamples(std::size_t count, const TIME_POINT_T& when);
+
+    /// Span tracking, as in FPSEstimator::BeginSpan() and EndSpan()
+    SpanToken BeginSpan();
+    void EndSpan(const SpanToken& token);
+    int64_t InFlight() const { return m_spans.InFlight(); }
+    void EnableSpanLatency(
+          float max_window_seconds = 10.f,
+          std::size_t slices = 20);
+    float SpanLatency(
+          float window_seconds,
+          float quantile = 0.5f);
+
+    /**
+     * Estimate FPS over a given window (see BucketedFPSEstimator::FPS()).
+     *
+     * @param window_seconds Number of past seconds over which to measure
+     * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
+     */
+    float FPS(
+          float window_seconds = 1.f,
+          bool soft_estimate = false);
+
+    /// Reset the instance
+    void Reset();
+
+    std::size_t Shards() const { return m_shards.size(); }
+
+  private:
+
+    /// Sentinel for "no sample yet"
+    static const int64_t NO_SAMPLE = INT64_MAX;
+
+    /// Per-thread shard number, handed out round-robin
+    static std::size_t ThreadIndex();
+
+    std::vector<CounterWheel> m_shards;
+    std::atomic<int64_t> m_first_sample;
+
+    SpanStats m_spans;
+
+    float m_rolling;
+    float m_decay_factor;
+  };
+
+  typedef BasicShardedFPSEstimator<> ShardedFPSEstimator;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicShardedFPSEstimator class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicShardedFPSEstimator<ClockT>::BasicShardedFPSEstimator(
+        std::size_t shards,
+        TIME_RESOLUTION_T bucket_width,
+        float max_window_seconds)
+  : m_first_sample(NO_SAMPLE),
+    m_rolling(0.f),
+    m_decay_factor(0.f)
+  {
+    if (shards == 0)
+      shards = std::thread::hardware_concurrency();
+    if (shards == 0)
+      shards = 1;
+    m_shards.reserve(shards);
+    for (std::size_t i = 0; i < shards; ++i)
+      m_shards.push_back(CounterWheel(bucket_width, max_window_seconds));
+  }
+
+  template <typename ClockT>
+  std::size_t BasicShardedFPSEstimator<ClockT>::ThreadIndex()
+  {
+    static std::atomic<std::size_t> next_index(0);
+    static thread_local std::size_t index =
+        next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+  }
+
+  /**
+   * Set decay factor
+   *
+   * @param new_decay_factor The new decay factor
+   */
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::SetDecayFactor(
+        float new_decay_factor)
+  {
+    m_decay_factor = new_decay_factor;
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::AddSample()
+  {
+    AddSample(ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::AddSample(const TIME_POINT_T& when)
+  {
+    AddSamples(1, when);
+  }
+
+  /// Add a batch of samples
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::AddSamples(
+        const TIME_POINT_T* begin,
+        const TIME_POINT_T* end)
+  {
+    if (begin == end)
+      return;
+    CounterWheel& wheel = m_shards[ThreadIndex() % m_shards.size()];
+
+    /// Merge runs of samples that fall into the same bucket
+    const int64_t width = wheel.BucketWidth();
+    int64_t run_start = TicksSinceEpoch(*begin);
+    int64_t oldest = run_start;
+    uint32_t run_length = 0;
+    for (; begin != end; ++begin) {
+      const int64_t ticks = TicksSinceEpoch(*begin);
+      if (FloorDivide(ticks, width) != FloorDivide(run_start, width)) {
+        wheel.Add(run_start, run_length);
+        run_start = ticks;
+        run_length = 0;
+      }
+      if (ticks < oldest)
+        oldest = ticks;
+      ++run_length;
+    }
+    wheel.Add(run_start, run_length);
+    StoreMinimum(m_first_sample, oldest);
+  }
+
+  /// Add "count" samples that all happened at "when"
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::AddSamples(
+        std::size_t count,
+        const TIME_POINT_T& when)
+  {
+    if (count == 0)
+      return;
+    const int64_t ticks = TicksSinceEpoch(when);
+    m_shards[ThreadIndex() % m_shards.size()].Add(ticks, static_cast<uint32_t>(count));
+    StoreMinimum(m_first_sample, ticks);
+  }
+
+  /// Start timing a span
+  template <typename ClockT>
+  SpanToken BasicShardedFPSEstimator<ClockT>::BeginSpan()
+  {
+    m_spans.Begin();
+    SpanToken token = { ClockT::Now() };
+    return token;
+  }
+
+  /// End a span
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::EndSpan(const SpanToken& token)
+  {
+    const TIME_POINT_T now = ClockT::Now();
+    AddSample(now);
+    m_spans.End(TicksSinceEpoch(now), TicksSinceEpoch(token.started));
+  }
+
+  /**
+   * Start recording span latencies
+   *
+   * @param max_window_seconds Longest window that can be queried
+   * @param slices Time slices per window
+   */
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::EnableSpanLatency(
+        float max_window_seconds,
+        std::size_t slices)
+  {
+    m_spans.EnableLatency(max_window_seconds, slices);
+  }
+
+  /**
+   * Latency quantile of recently ended spans
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param quantile Quantile (0..1)
+   */
+  template <typename ClockT>
+  float BasicShardedFPSEstimator<ClockT>::SpanLatency(float window_seconds,
+                                                      float quantile)
+  {
+    return m_spans.Latency(TicksSinceEpoch(ClockT::Now()), window_seconds,
+                           quantile);
+  }
+
+  /**
+   * Estimate FPS over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param soft_estimate IFF TRUE, the return value slowly changes (rolling weighted average)
+   */
+  template <typename ClockT>
+  float BasicShardedFPSEstimator<ClockT>::FPS(float window_seconds,
+                                              bool soft_estimate)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window_start = now - SecondsToTicks(window_seconds);
+
+    /// Not enough data to fill the time window
+    if (m_first_sample.load(std::memory_order_relaxed) > window_start)
+      return -1.f;
+
+    double samples = 0.;
+    for (std::size_t i = 0; i < m_shards.size(); ++i) {
+      const double shard_samples = m_shards[i].Sum(window_start, now);
+      if (shard_samples < 0.)
+        return -1.f;
+      samples += shard_samples;
+    }
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: " << samples << " samples in "
+                << window_seconds << "s from " << m_shards.size()
+                << " shards\n";
+    #endif
+
+    const float fps_estimate = static_cast<float>(samples) / window_seconds;
+
+    /// Adjust the rolling weighted average estimate
+    m_rolling =      m_decay_factor  * m_rolling +
+                (1.f-m_decay_factor) * fps_estimate;
+
+    if (soft_estimate)
+      return m_rolling;
+    else
+      return fps_estimate;
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicShardedFPSEstimator<ClockT>::Reset()
+  {
+    for (std::size_t i = 0; i < m_shards.size(); ++i)
+      m_shards[i].Clear();
+    m_first_sample.store(NO_SAMPLE, std::memory_order_relaxed);
+    m_spans.Clear();
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+    #endif
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicCompactFPSEstimator class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Minimal estimator for very large numbers of instances (e.g. one per
+   * connection): 32 bytes, no heap allocation, no lock and no history.
+   * It keeps an event count, the time of the newest event and the
+   * exponentially decaying rate of DecayingRate with time constant tau,
+   * its log-domain sum taken relative to the clock's epoch so that no
+   * origin has to be stored. All operations are O(1) and lock-free.
+   */
+  template <typename ClockT = SteadyClock>
+  class BasicCompactFPSEstimator {
+
+  public:
+
+    /// Constructor, "tau_seconds" being the time constant of the rate
+    explicit BasicCompactFPSEstimator(
+          float tau_seconds = 1.f);
+
+    /// Add a sample
+    void AddSample();
+
+    /// Add a sample with an externally measured time point
+    void AddSample(const TIME_POINT_T& when);
+
+    /// Add "count" samples that all happened at "when"
+    void AddSamples(std::size_t count, const TIME_POINT_T& when);
+
+    /**
+     * @returns the exponentially decaying rate, or a negative value if
+     *          no sample has been added yet
+     */
+    float FPS() const;
+
+    /// Number of samples since construction or Reset()
+    uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+
+    /// Time point of the newest sample
+    TIME_POINT_T LastSample() const
+    {
+      return TIME_POINT_T(TIME_RESOLUTION_T(
+                 m_last_sample.load(std::memory_order_relaxed)));
+    }
+
+    /// Reset the instance
+    void Reset();
+
+  private:
+
+    std::atomic<uint64_t> m_count;
+    std::atomic<int64_t> m_last_sample;
+    std::atomic<double> m_log_sum;
+    double m_tau;
+  };
+
+  typedef BasicCompactFPSEstimator<> CompactFPSEstimator;
+
+  static_assert(sizeof(CompactFPSEstimator) <= 32,
+                "CompactFPSEstimator must stay within 32 bytes");
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicCompactFPSEstimator class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicCompactFPSEstimator<ClockT>::BasicCompactFPSEstimator(
+        float tau_seconds)
+  : m_count(0),
+    m_last_sample(INT64_MIN),
+    m_log_sum(-HUGE_VAL),
+    m_tau(static_cast<double>(SecondsToTicks(tau_seconds)))
+  {
+    if (!(m_tau > 0.))
+      throw std::invalid_argument("CompactFPSEstimator: Time constant must "
+                                  "be positive");
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicCompactFPSEstimator<ClockT>::AddSample()
+  {
+    AddSamples(1, ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicCompactFPSEstimator<ClockT>::AddSample(const TIME_POINT_T& when)
+  {
+    AddSamples(1, when);
+  }
+
+  /// Add "count" samples that all happened at "when"
+  template <typename ClockT>
+  void BasicCompactFPSEstimator<ClockT>::AddSamples(
+        std::size_t count,
+        const TIME_POINT_T& when)
+  {
+    if (count == 0)
+      return;
+    const int64_t ticks = TicksSinceEpoch(when);
+    m_count.fetch_add(count, std::memory_order_relaxed);
+    m_last_sample.store(ticks, std::memory_order_relaxed);
+    AddLogExp(m_log_sum,
+              ticks / m_tau + std::log(static_cast<double>(count)));
+  }
+
+  /// Exponentially decaying rate
+  template <typename ClockT>
+  float BasicCompactFPSEstimator<ClockT>::FPS() const
+  {
+    if (m_count.load(std::memory_order_relaxed) == 0)
+      return -1.f;
+    const double elapsed = TicksSinceEpoch(ClockT::Now()) / m_tau;
+    const double ticks_per_second =
+        TIME_RESOLUTION_T(std::chrono::seconds(1)).count();
+    return static_cast<float>(
+               std::exp(m_log_sum.load(std::memory_order_relaxed) - elapsed) *
+               ticks_per_second / m_tau);
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicCompactFPSEstimator<ClockT>::Reset()
+  {
+    m_count.store(0, std::memory_order_relaxed);
+    m_last_sample.store(INT64_MIN, std::memory_order_relaxed);
+    m_log_sum.store(-HUGE_VAL, std::memory_order_relaxed);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+    #endif
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicFPSRegistry class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Named collection of estimators. Register() interns a name once (under
+   * a lock) and returns a small integer handle; after that, AddSample()
+   * and FPS() on a handle are a plain array access with no hashing or
+   * locking. The estimators are created in place and never move, so
+   * non-movable estimator types are fine. Capacity is fixed at
+   * construction.
+   *
+   * "EstimatorT" needs AddSample(), AddSample(const TIME_POINT_T&) and
+   * FPS(float), as FPSEstimator, BucketedFPSEstimator and
+   * ShardedFPSEstimator have.
+   */
+  template <typename EstimatorT = FPSEstimator>
+  class BasicFPSRegistry {
+
+  public:
+
+    typedef uint32_t Handle;
+    typedef std::function<EstimatorT*()> Factory;
+
+    /// Returned by Find() for unknown names
+    static const Handle INVALID_HANDLE = 0xffffffffu;
+
+    /**
+     * Constructor
+     *
+     * @param capacity Maximum number of registered names
+     * @param factory Creates a new estimator (default: "new EstimatorT()")
+     */
+    explicit BasicFPSRegistry(
+          std::size_t capacity = 1024,
+          const Factory& factory = Factory());
+
+    /// Destructor
+    ~BasicFPSRegistry();
+
+    /**
+     * Intern "name" and create its estimator, or return the handle it
+     * already has
+     *
+     * @throws std::length_error if the registry is full
+     */
+    Handle Register(
+          const std::string& name);
+
+    /// Handle of "name", or INVALID_HANDLE if it is not registered
+    Handle Find(
+          const std::string& name) const;
+
+    /// Add a sample to the estimator behind "handle"
+    void AddSample(Handle handle) { m_estimators[handle]->AddSample(); }
+
+    /// Add a sample with an externally measured time point
+    void AddSample(Handle handle, const TIME_POINT_T& when)
+    {
+      m_estimators[handle]->AddSample(when);
+    }
+
+    /// The estimator behind "handle"
+    EstimatorT& operator[](Handle handle) { return *m_estimators[handle]; }
+
+    /// Registered name of "handle"
+    const std::string& Name(Handle handle) const { return m_names[handle]; }
+
+    /// Number of registered names; handles are 0..Size()-1
+    std::size_t Size() const { return m_size.load(std::memory_order_acquire); }
+
+    /**
+     * Estimate the rates of all registered estimators over the same
+     * window
+     *
+     * @param rates Receives one rate per handle (index = handle);
+     *              negative where there is not enough data
+     */
+    void Snapshot(
+          float window_seconds,
+          std::vector<float>& rates);
+
+  private:
+
+    BasicFPSRegistry(const BasicFPSRegistry&);
+    BasicFPSRegistry& operator=(const BasicFPSRegistry&);
+
+    Factory m_factory;
+    /// Preallocated to capacity, so entries never move
+    std::vector<EstimatorT*> m_estimators;
+    std::vector<std::string> m_names;
+    std::atomic<std::size_t> m_size;
+    std::unordered_map<std::string, Handle> m_handles;
+    mutable std::mutex m_handles__mutex;
+  };
+
+  typedef BasicFPSRegistry<> FPSRegistry;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicFPSRegistry class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename EstimatorT>
+  BasicFPSRegistry<EstimatorT>::BasicFPSRegistry(
+        std::size_t capacity,
+        const Factory& factory)
+  : m_factory(factory),
+    m_estimators(capacity, static_cast<EstimatorT*>(NULL)),
+    m_names(capacity),
+    m_size(0)
+  {
+    if (capacity == 0 || capacity > INVALID_HANDLE)
+      throw std::invalid_argument("FPSRegistry: Invalid capacity");
+  }
+
+  /// Destructor
+  template <typename EstimatorT>
+  BasicFPSRegistry<EstimatorT>::~BasicFPSRegistry()
+  {
+    for (std::size_t i = 0; i < m_estimators.size(); ++i)
+      delete m_estimators[i];
+  }
+
+  /**
+   * Intern a name
+   *
+   * @param name Name of the estimator
+   */
+  template <typename EstimatorT>
+  typename BasicFPSRegistry<EstimatorT>::Handle
+  BasicFPSRegistry<EstimatorT>::Register(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(m_handles__mutex);
+    typename std::unordered_map<std::string, Handle>::const_iterator known =
+        m_handles.find(name);
+    if (known != m_handles.end())
+      return known->second;
+
+    const std::size_t size = m_size.load(std::memory_order_relaxed);
+    if (size == m_estimators.size())
+      throw std::length_error("FPSRegistry: Capacity exhausted");
+    m_estimators[size] = m_factory ? m_factory() : new EstimatorT();
+    m_names[size] = name;
+    const Handle handle = static_cast<Handle>(size);
+    m_handles[name] = handle;
+    /// Publish the new entry to lock-free readers of Size()
+    m_size.store(size+1, std::memory_order_release);
+    return handle;
+  }
+
+  /**
+   * Look up a name
+   *
+   * @param name Name of the estimator
+   */
+  template <typename EstimatorT>
+  typename BasicFPSRegistry<EstimatorT>::Handle
+  BasicFPSRegistry<EstimatorT>::Find(const std::string& name) const
+  {
+    std::lock_guard<std::mutex> lock(m_handles__mutex);
+    typename std::unordered_map<std::string, Handle>::const_iterator known =
+        m_handles.find(name);
+    return (known != m_handles.end()) ? known->second : INVALID_HANDLE;
+  }
+
+  /**
+   * Estimate all rates
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param rates Receives one rate per handle
+   */
+  template <typename EstimatorT>
+  void BasicFPSRegistry<EstimatorT>::Snapshot(float window_seconds,
+                                              std::vector<float>& rates)
+  {
+    const std::size_t size = Size();
+    rates.resize(size);
+    for (std::size_t i = 0; i < size; ++i)
+      rates[i] = m_estimators[i]->FPS(window_seconds);
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicKeyedFPSEstimator class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Per-key rates for very many keys (e.g. client addresses) in fixed
+   * memory. Samples are counted in Count-Min sketches: "depth" rows of
+   * "width" counters, each row indexed by its own hash of the key, so a
+   * key's count is the minimum over its counters (it can only be
+   * overestimated, by collisions). The window is a ring of such sketches,
+   * one per time slice, expired lazily like IntervalHistogram slices.
+   *
+   * For "which keys are the busiest right now", a list of candidate heavy
+   * hitters (twice the requested number) is kept next to the sketches,
+   * with each candidate's last estimate. Samples of candidates refresh
+   * that estimate without locking; any other key only takes the list's
+   * lock when its estimate beats the weakest candidate. AddSample() thus
+   * costs depth*(slices+1) counter reads, "depth" atomic increments and
+   * a short scan of the candidate keys.
+   */
+  template <typename ClockT = SteadyClock>
+  class BasicKeyedFPSEstimator {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param heavy_hitters Number of keys TopK() can report
+     * @param max_window_seconds Longest window that can be asked for
+     * @param slices Time slices per window
+     * @param width Counters per sketch row (rounded up to a power of two)
+     * @param depth Sketch rows (hash functions)
+     */
+    explicit BasicKeyedFPSEstimator(
+          std::size_t heavy_hitters = 20,
+          float max_window_seconds = 10.f,
+          std::size_t slices = 10,
+          std::size_t width = 2048,
+          std::size_t depth = 4);
+
+    /// Add a sample for "key"
+    void AddSample(uint64_t key);
+
+    /// Add a sample for "key" with an externally measured time point
+    void AddSample(uint64_t key, const TIME_POINT_T& when);
+
+    /**
+     * Estimate the rate of "key" over the past "window_seconds"
+     *
+     * @returns the rate (never an underestimate), or a negative value if
+     *          the estimator has not been running for "window_seconds"
+     *          or the window is longer than the maximum
+     */
+    float FPS(
+          uint64_t key,
+          float window_seconds = 1.f);
+
+    /**
+     * The busiest keys over the past "window_seconds"
+     *
+     * @param top Receives up to "heavy_hitters" (key, rate) pairs, the
+     *            busiest first
+     */
+    void TopK(
+          float window_seconds,
+          std::vector<std::pair<uint64_t, float> >& top);
+
+    /// Reset the instance
+    void Reset();
+
+  private:
+
+    /// Sentinel for "no sample yet"
+    static const int64_t NO_SAMPLE = INT64_MAX;
+
+    struct Slice {
+      std::atomic<int64_t> id;
+      /// "depth" rows of "width" counters
+      std::vector<std::atomic<uint32_t> > counts;
+    };
+
+    /// Heavy hitter candidate, written under the lock, read without
+    struct Candidate {
+      std::atomic<uint64_t> key;
+      std::atomic<double> estimate;
+    };
+
+    /// Counter of "key" in sketch row "row"
+    std::size_t Cell(std::size_t row, uint64_t key) const;
+
+    /// Count-Min estimate of the samples of "key" in (from, to]
+    double Estimate(uint64_t key, int64_t from, int64_t to) const;
+
+    /// Offer "key" to the heavy hitter candidates
+    void Admit(uint64_t key, double estimate, int64_t now);
+
+    std::vector<Slice> m_slices;
+    int64_t m_slice_width;
+    int64_t m_max_window;
+    std::size_t m_width_mask;
+    std::size_t m_depth;
+    std::mutex m_rollover__mutex;
+
+    std::atomic<int64_t> m_first_sample;
+
+    std::size_t m_heavy_hitters;
+    std::vector<Candidate> m_candidates;
+    std::atomic<std::size_t> m_candidate_count;
+    /// Estimate a key needs to be offered to the candidates
+    std::atomic<double> m_admission;
+    /// Set when a slice expired, making cached estimates stale
+    std::atomic<bool> m_refresh;
+    std::mutex m_candidates__mutex;
+  };
+
+  typedef BasicKeyedFPSEstimator<> KeyedFPSEstimator;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicKeyedFPSEstimator class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicKeyedFPSEstimator<ClockT>::BasicKeyedFPSEstimator(
+        std::size_t heavy_hitters,
+        float max_window_seconds,
+        std::size_t slices,
+        std::size_t width,
+        std::size_t depth)
+  : m_slice_width(0),
+    m_max_window(SecondsToTicks(max_window_seconds)),
+    m_width_mask(0),
+    m_depth(depth),
+    m_first_sample(NO_SAMPLE),
+    m_heavy_hitters(heavy_hitters),
+    m_candidate_count(0),
+    m_admission(0.),
+    m_refresh(false)
+  {
+    if (max_window_seconds <= 0.f || slices == 0 || width == 0 ||
+        depth == 0 || heavy_hitters == 0)
+      throw std::invalid_argument("KeyedFPSEstimator: Window, slice count, "
+                                  "sketch size and heavy hitter count must "
+                                  "be positive");
+    std::size_t rounded = 1;
+    while (rounded < width)
+      rounded <<= 1;
+    m_width_mask = rounded-1;
+    m_slice_width = m_max_window / static_cast<int64_t>(slices);
+    if (m_slice_width <= 0)
+      m_slice_width = 1;
+
+    /// One extra slice for the partially covered oldest one
+    std::vector<Slice> ring(slices+1);
+    m_slices.swap(ring);
+    for (std::size_t s = 0; s < m_slices.size(); ++s) {
+      std::vector<std::atomic<uint32_t> > counts(rounded*depth);
+      m_slices[s].counts.swap(counts);
+    }
+    std::vector<Candidate> candidates(2*heavy_hitters);
+    m_candidates.swap(candidates);
+    Reset();
+  }
+
+  /// Counter of "key" in a sketch row
+  template <typename ClockT>
+  std::size_t BasicKeyedFPSEstimator<ClockT>::Cell(std::size_t row,
+                                                   uint64_t key) const
+  {
+    return row*(m_width_mask+1) + (HashKey(key, row) & m_width_mask);
+  }
+
+  /// Count-Min estimate over a time range
+  template <typename ClockT>
+  double BasicKeyedFPSEstimator<ClockT>::Estimate(uint64_t key,
+                                                  int64_t from,
+                                                  int64_t to) const
+  {
+    const int64_t first = FloorDivide(from, m_slice_width);
+    const int64_t last = FloorDivide(to, m_slice_width);
+    /// Only the part of the oldest slice after "from" is inside
+    const double partial =
+        static_cast<double>((first+1)*m_slice_width - from) / m_slice_width;
+
+    double estimate = -1.;
+    for (std::size_t row = 0; row < m_depth; ++row) {
+      const std::size_t cell = Cell(row, key);
+      double sum = 0.;
+      for (std::size_t s = 0; s < m_slices.size(); ++s) {
+        const Slice& slice = m_slices[s];
+        const int64_t id = slice.id.load(std::memory_order_acquire);
+        if (id < first || id > last)
+          continue;
+        const double count = slice.counts[cell].load(
+                                 std::memory_order_relaxed);
+        sum += (id == first) ? count*partial : count;
+      }
+      if (estimate < 0. || sum < estimate)
+        estimate = sum;
+    }
+    return estimate;
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicKeyedFPSEstimator<ClockT>::AddSample(uint64_t key)
+  {
+    AddSample(key, ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicKeyedFPSEstimator<ClockT>::AddSample(uint64_t key,
+                                                 const TIME_POINT_T& when)
+  {
+    const int64_t ticks = TicksSinceEpoch(when);
+    const int64_t id = FloorDivide(ticks, m_slice_width);
+    Slice& slice = m_slices[id % static_cast<int64_t>(m_slices.size())];
+    if (slice.id.load(std::memory_order_acquire) != id) {
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      if (slice.id.load(std::memory_order_relaxed) < id) {
+        for (std::size_t i = 0; i < slice.counts.size(); ++i)
+          slice.counts[i].store(0, std::memory_order_relaxed);
+        slice.id.store(id, std::memory_order_release);
+        /// Candidates lose counts as slices expire; re-derive the bar
+        m_refresh.store(true, std::memory_order_relaxed);
+        m_admission.store(0., std::memory_order_relaxed);
+      } else if (slice.id.load(std::memory_order_relaxed) > id) {
+        /// Too old for the ring
+        return;
+      }
+    }
+    for (std::size_t row = 0; row < m_depth; ++row)
+      slice.counts[Cell(row, key)].fetch_add(1, std::memory_order_relaxed);
+    StoreMinimum(m_first_sample, ticks);
+
+    const double estimate = Estimate(key, ticks-m_max_window, ticks);
+    if (estimate > m_admission.load(std::memory_order_relaxed))
+      Admit(key, estimate, ticks);
+  }
+
+  /// Offer a key to the heavy hitter candidates
+  template <typename ClockT>
+  void BasicKeyedFPSEstimator<ClockT>::Admit(uint64_t key,
+                                             double estimate,
+                                             int64_t now)
+  {
+    /// Known candidates just refresh their estimate, without locking
+    std::size_t size = m_candidate_count.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < size; ++i) {
+      if (m_candidates[i].key.load(std::memory_order_relaxed) == key) {
+        m_candidates[i].estimate.store(estimate, std::memory_order_relaxed);
+        return;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_candidates__mutex);
+    size = m_candidate_count.load(std::memory_order_relaxed);
+    if (m_refresh.exchange(false, std::memory_order_relaxed)) {
+      for (std::size_t i = 0; i < size; ++i)
+        m_candidates[i].estimate.store(
+            Estimate(m_candidates[i].key.load(std::memory_order_relaxed),
+                     now-m_max_window, now),
+            std::memory_order_relaxed);
+    }
+    for (std::size_t i = 0; i < size; ++i)
+      if (m_candidates[i].key.load(std::memory_order_relaxed) == key)
+        return;
+
+    if (size < m_candidates.size()) {
+      m_candidates[size].key.store(key, std::memory_order_relaxed);
+      m_candidates[size].estimate.store(estimate, std::memory_order_relaxed);
+      m_candidate_count.store(++size, std::memory_order_release);
+      if (size < m_candidates.size())
+        return;
+    } else {
+      /// Full list: "key" replaces the weakest candidate if it beats it
+      std::size_t weakest = 0;
+      for (std::size_t i = 1; i < size; ++i)
+        if (m_candidates[i].estimate.load(std::memory_order_relaxed) <
+            m_candidates[weakest].estimate.load(std::memory_order_relaxed))
+          weakest = i;
+      if (estimate > m_candidates[weakest].estimate.load(
+                         std::memory_order_relaxed)) {
+        m_candidates[weakest].key.store(key, std::memory_order_relaxed);
+        m_candidates[weakest].estimate.store(estimate,
+                                             std::memory_order_relaxed);
+      }
+    }
+
+    double bar = m_candidates[0].estimate.load(std::memory_order_relaxed);
+    for (std::size_t i = 1; i < size; ++i) {
+      const double candidate =
+          m_candidates[i].estimate.load(std::memory_order_relaxed);
+      if (candidate < bar)
+        bar = candidate;
+    }
+    m_admission.store(bar, std::memory_order_relaxed);
+  }
+
+  /**
+   * Estimate the rate of a key over a given window
+   *
+   * @param key Key to estimate
+   * @param window_seconds Number of past seconds over which to measure
+   */
+  template <typename ClockT>
+  float BasicKeyedFPSEstimator<ClockT>::FPS(uint64_t key,
+                                            float window_seconds)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (window > m_max_window ||
+        m_first_sample.load(std::memory_order_relaxed) > now-window)
+      return -1.f;
+    return static_cast<float>(Estimate(key, now-window, now) /
+                              window_seconds);
+  }
+
+  /**
+   * The busiest keys over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param top Receives (key, rate) pairs, the busiest first
+   */
+  template <typename ClockT>
+  void BasicKeyedFPSEstimator<ClockT>::TopK(
+        float window_seconds,
+        std::vector<std::pair<uint64_t, float> >& top)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (window > m_max_window)
+      throw std::invalid_argument("KeyedFPSEstimator: Window exceeds the "
+                                  "maximum given at construction");
+    top.resize(m_candidate_count.load(std::memory_order_acquire));
+    for (std::size_t i = 0; i < top.size(); ++i)
+      top[i].first = m_candidates[i].key.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < top.size(); ++i)
+      top[i].second = static_cast<float>(
+                          Estimate(top[i].first, now-window, now) /
+                          window_seconds);
+    std::sort(top.begin(), top.end(),
+              [](const std::pair<uint64_t, float>& a,
+                 const std::pair<uint64_t, float>& b) {
+                return a.second > b.second;
+              });
+    if (top.size() > m_heavy_hitters)
+      top.resize(m_heavy_hitters);
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicKeyedFPSEstimator<ClockT>::Reset()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      for (std::size_t s = 0; s < m_slices.size(); ++s) {
+        m_slices[s].id.store(INT64_MIN, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < m_slices[s].counts.size(); ++i)
+          m_slices[s].counts[i].store(0, std::memory_order_relaxed);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_candidates__mutex);
+      m_candidate_count.store(0, std::memory_order_relaxed);
+      m_admission.store(0., std::memory_order_relaxed);
+      m_refresh.store(false, std::memory_order_relaxed);
+    }
+    m_first_sample.store(NO_SAMPLE, std::memory_order_relaxed);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+    #endif
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicDistinctFPSEstimator class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Counts distinct keys (e.g. users) over a recent window, next to the
+   * plain event rate, in fixed memory. Each time slice holds an event
+   * counter and a HyperLogLog sketch: 2^precision one-byte registers,
+   * each keeping the longest run of leading zeros seen among the hashes
+   * routed to it. The standard error is about 1.04/sqrt(2^precision),
+   * i.e. ~1.6% at the default precision of 12 (4 KiB per slice).
+   *
+   * A window query merges the registers of its slices by taking their
+   * maximum. Distinct counts cannot be split, so for Distinct() the
+   * window is rounded up to whole slices; FPS() counts the oldest slice
+   * in proportion to its overlap, like KeyedFPSEstimator. AddSample() is
+   * lock-free except for the first sample of each slice, which clears it.
+   */
+  template <typename ClockT = SteadyClock>
+  class BasicDistinctFPSEstimator {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param max_window_seconds Longest window that can be asked for
+     * @param slices Time slices per window
+     * @param precision Log2 of the number of registers per slice (4..18)
+     */
+    explicit BasicDistinctFPSEstimator(
+          float max_window_seconds = 10.f,
+          std::size_t slices = 10,
+          unsigned precision = 12);
+
+    /// Add a sample for "key"
+    void AddSample(uint64_t key);
+
+    /// Add a sample for "key" with an externally measured time point
+    void AddSample(uint64_t key, const TIME_POINT_T& when);
+
+    /**
+     * Estimate the number of distinct keys over the past
+     * "window_seconds" (rounded up to whole slices)
+     *
+     * @returns the estimate, or a negative value if the estimator has not
+     *          been running for "window_seconds" or the window is longer
+     *          than the maximum
+     */
+    float Distinct(
+          float window_seconds = 1.f);
+
+    /**
+     * Estimate the event rate (all keys) over the past "window_seconds"
+     *
+     * @returns the rate, or a negative value as for Distinct()
+     */
+    float FPS(
+          float window_seconds = 1.f);
+
+    /// Reset the instance
+    void Reset();
+
+  private:
+
+    /// Sentinel for "no sample yet"
+    static const int64_t NO_SAMPLE = INT64_MAX;
+
+    struct Slice {
+      std::atomic<int64_t> id;
+      std::atomic<uint64_t> events;
+      std::vector<std::atomic<uint8_t> > registers;
+    };
+
+    /// Whether the estimator has been running for the window before "now"
+    bool Covers(int64_t now, int64_t window) const;
+
+    std::vector<Slice> m_slices;
+    int64_t m_slice_width;
+    int64_t m_max_window;
+    unsigned m_precision;
+    std::mutex m_rollover__mutex;
+
+    std::atomic<int64_t> m_first_sample;
+  };
+
+  typedef BasicDistinctFPSEstimator<> DistinctFPSEstimator;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicDistinctFPSEstimator class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicDistinctFPSEstimator<ClockT>::BasicDistinctFPSEstimator(
+        float max_window_seconds,
+        std::size_t slices,
+        unsigned precision)
+  : m_slice_width(0),
+    m_max_window(SecondsToTicks(max_window_seconds)),
+    m_precision(precision),
+    m_first_sample(NO_SAMPLE)
+  {
+    if (max_window_seconds <= 0.f || slices == 0)
+      throw std::invalid_argument("DistinctFPSEstimator: Window and slice "
+                                  "count must be positive");
+    if (precision < 4 || precision > 18)
+      throw std::invalid_argument("DistinctFPSEstimator: Precision must be "
+                                  "in 4..18");
+    m_slice_width = m_max_window / static_cast<int64_t>(slices);
+    if (m_slice_width <= 0)
+      m_slice_width = 1;
+
+    /// One extra slice for the partially covered oldest one
+    std::vector<Slice> ring(slices+1);
+    m_slices.swap(ring);
+    for (std::size_t s = 0; s < m_slices.size(); ++s) {
+      std::vector<std::atomic<uint8_t> > registers(std::size_t(1) << precision);
+      m_slices[s].registers.swap(registers);
+    }
+    Reset();
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicDistinctFPSEstimator<ClockT>::AddSample(uint64_t key)
+  {
+    AddSample(key, ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicDistinctFPSEstimator<ClockT>::AddSample(uint64_t key,
+                                                    const TIME_POINT_T& when)
+  {
+    const int64_t ticks = TicksSinceEpoch(when);
+    const int64_t id = FloorDivide(ticks, m_slice_width);
+    Slice& slice = m_slices[id % static_cast<int64_t>(m_slices.size())];
+    if (slice.id.load(std::memory_order_acquire) != id) {
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      if (slice.id.load(std::memory_order_relaxed) < id) {
+        slice.events.store(0, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < slice.registers.size(); ++i)
+          slice.registers[i].store(0, std::memory_order_relaxed);
+        slice.id.store(id, std::memory_order_release);
+      } else if (slice.id.load(std::memory_order_relaxed) > id) {
+        /// Too old for the ring
+        return;
+      }
+    }
+    slice.events.fetch_add(1, std::memory_order_relaxed);
+    StoreMinimum(m_first_sample, ticks);
+
+    /// Top bits pick the register, the rest give the rank
+    const uint64_t hash = HashKey(key, 0);
+    const std::size_t index = static_cast<std::size_t>(
+                                  hash >> (64-m_precision));
+    const uint64_t rest = hash << m_precision;
+    const uint8_t rank = static_cast<uint8_t>(
+        rest ? LeadingZeros(rest) + 1 : 64-m_precision+1);
+    std::atomic<uint8_t>& reg = slice.registers[index];
+    uint8_t current = reg.load(std::memory_order_relaxed);
+    while (rank > current &&
+           !reg.compare_exchange_weak(current, rank,
+                                      std::memory_order_relaxed)) { }
+  }
+
+  /// Whether the estimator has been running long enough
+  template <typename ClockT>
+  bool BasicDistinctFPSEstimator<ClockT>::Covers(int64_t now,
+                                                 int64_t window) const
+  {
+    return window <= m_max_window &&
+           m_first_sample.load(std::memory_order_relaxed) <= now-window;
+  }
+
+  /**
+   * Estimate the number of distinct keys over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   */
+  template <typename ClockT>
+  float BasicDistinctFPSEstimator<ClockT>::Distinct(float window_seconds)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (!Covers(now, window))
+      return -1.f;
+    const int64_t first = FloorDivide(now-window, m_slice_width);
+    const int64_t last = FloorDivide(now, m_slice_width);
+
+    const std::size_t size = std::size_t(1) << m_precision;
+    std::vector<uint8_t> merged(size, 0);
+    for (std::size_t s = 0; s < m_slices.size(); ++s) {
+      const Slice& slice = m_slices[s];
+      const int64_t id = slice.id.load(std::memory_order_acquire);
+      if (id < first || id > last)
+        continue;
+      for (std::size_t i = 0; i < size; ++i) {
+        const uint8_t rank = slice.registers[i].load(std::memory_order_relaxed);
+        if (rank > merged[i])
+          merged[i] = rank;
+      }
+    }
+
+    double inverse_sum = 0.;
+    std::size_t zeros = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      inverse_sum += std::ldexp(1., -merged[i]);
+      zeros += (merged[i] == 0);
+    }
+    const double m = static_cast<double>(size);
+    const double alpha = 0.7213 / (1. + 1.079/m);
+    double estimate = alpha * m * m / inverse_sum;
+    /// Small range: linear counting on the empty registers
+    if (estimate <= 2.5*m && zeros > 0)
+      estimate = m * std::log(m / zeros);
+    return static_cast<float>(estimate);
+  }
+
+  /**
+   * Estimate the event rate over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   */
+  template <typename ClockT>
+  float BasicDistinctFPSEstimator<ClockT>::FPS(float window_seconds)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (!Covers(now, window))
+      return -1.f;
+    const int64_t from = now-window;
+    const int64_t first = FloorDivide(from, m_slice_width);
+    const int64_t last = FloorDivide(now, m_slice_width);
+    /// Only the part of the oldest slice after "from" is inside
+    const double partial =
+        static_cast<double>((first+1)*m_slice_width - from) / m_slice_width;
+
+    double events = 0.;
+    for (std::size_t s = 0; s < m_slices.size(); ++s) {
+      const Slice& slice = m_slices[s];
+      const int64_t id = slice.id.load(std::memory_order_acquire);
+      if (id < first || id > last)
+        continue;
+      const double count = static_cast<double>(
+                               slice.events.load(std::memory_order_relaxed));
+      events += (id == first) ? count*partial : count;
+    }
+    return static_cast<float>(events / window_seconds);
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicDistinctFPSEstimator<ClockT>::Reset()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      for (std::size_t s = 0; s < m_slices.size(); ++s) {
+        m_slices[s].id.store(INT64_MIN, std::memory_order_relaxed);
+        m_slices[s].events.store(0, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < m_slices[s].registers.size(); ++i)
+          m_slices[s].registers[i].store(0, std::memory_order_relaxed);
+      }
+    }
+    m_first_sample.store(NO_SAMPLE, std::memory_order_relaxed);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+    #endif
+  }
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicFPSEstimatorBank class template declaration
+  /// /////////////////////////////////////////////////////////////////
+  /**
+   * Many independent event counters (e.g. one per exported metric) kept
+   * in one struct-of-arrays block: time is cut into buckets as in
+   * BucketedFPSEstimator, and for every bucket the counts of all
+   * counters lie next to each other:
+   *
+   *   [ bucket 0: c0 c1 c2 ... cN-1 | bucket 1: c0 c1 ... | ... ]
+   *
+   * Producers and readers use different copies of a bucket: samples for
+   * the newest bucket go to an atomic "live" row, so AddSample(counter)
+   * is a single atomic increment. When time moves on, the bucket that
+   * was newest is folded, under the rollover lock, into a plain
+   * uint32_t "frozen" row; samples for older buckets are added to their
+   * frozen row under the same lock. Rates() holds that lock and sums the
+   * frozen rows with plain loops over all counters, which the compiler
+   * vectorizes, and reads only the newest bucket's live row with relaxed
+   * atomic loads. This is far cheaper than one FPS() call per estimator
+   * object. A rate may miss increments that race with the sweep.
+   *
+   * The price of the shared layout is one bucket width of time
+   * resolution, as with BucketedFPSEstimator.
+   */
+  template <typename ClockT = SteadyClock>
+  class BasicFPSEstimatorBank {
+
+  public:
+
+    /**
+     * Constructor
+     *
+     * @param counters Number of counters
+     * @param bucket_width Time span counted by one bucket
+     * @param max_window_seconds Longest window that can be asked for
+     */
+    explicit BasicFPSEstimatorBank(
+          std::size_t counters,
+          TIME_RESOLUTION_T bucket_width = std::chrono::milliseconds(100),
+          float max_window_seconds = 10.f);
+
+    /// Add a sample to "counter"
+    void AddSample(std::size_t counter);
+
+    /// Add a sample to "counter" with an externally measured time point
+    void AddSample(std::size_t counter, const TIME_POINT_T& when);
+
+    /// Add "count" samples to "counter" that all happened at "when"
+    void AddSamples(std::size_t counter,
+                    std::size_t count,
+                    const TIME_POINT_T& when);
+
+    /**
+     * Estimate the rates of all counters over the past "window_seconds"
+     *
+     * @param rates Receives Size() rates, all negative if the bank has
+     *              not been running for "window_seconds" or the window is
+     *              longer than the maximum
+     */
+    void Rates(
+          float window_seconds,
+          float* rates);
+
+    /// Vector version of Rates()
+    void Rates(
+          float window_seconds,
+          std::vector<float>& rates);
+
+    /// Estimate the rate of a single counter (see Rates())
+    float FPS(
+          std::size_t counter,
+          float window_seconds = 1.f);
+
+    std::size_t Size() const { return m_counters; }
+
+    /// Reset the instance
+    void Reset();
+
+  private:
+
+    /// Sentinel for "no sample yet"
+    static const int64_t NO_SAMPLE = INT64_MAX;
+
+    /// Ring slot of bucket "bucket"
+    std::size_t Index(int64_t bucket) const;
+
+    /// Make slot "index" hold bucket "bucket", with zero counts
+    /// (rollover lock held)
+    void Claim(std::size_t index, int64_t bucket);
+
+    /// Make "bucket" the newest one and fold the previous newest one
+    /// into its frozen row (rollover lock held)
+    void Advance(int64_t bucket);
+
+    /// Add samples to a bucket that is not newest, or is about to be
+    /// (rollover lock held)
+    void AddLocked(int64_t bucket, std::size_t counter, uint32_t count);
+
+    /// Sum the window's buckets into "sums" (Size() entries)
+    bool Sweep(float window_seconds, float* sums);
+
+    std::size_t m_counters;
+    /// Row length, padded to whole cache lines
+    std::size_t m_stride;
+    int64_t m_bucket_width;
+    int64_t m_max_window;
+
+    /// Counts of the newest bucket, written by producers without a lock
+    std::vector<std::atomic<uint32_t> > m_live;
+    std::atomic<int64_t> m_newest;
+
+    /// Counts of the other buckets, and the bucket of every slot
+    std::vector<uint32_t> m_frozen;
+    std::vector<int64_t> m_buckets;
+    /// Scratch space for Sweep()
+    std::vector<uint32_t> m_totals;
+    std::mutex m_rollover__mutex;
+
+    std::atomic<int64_t> m_first_sample;
+  };
+
+  typedef BasicFPSEstimatorBank<> FPSEstimatorBank;
+
+
+
+  /// /////////////////////////////////////////////////////////////////
+  /// BasicFPSEstimatorBank class template implementation
+  /// /////////////////////////////////////////////////////////////////
+
+  /// Constructor
+  template <typename ClockT>
+  BasicFPSEstimatorBank<ClockT>::BasicFPSEstimatorBank(
+        std::size_t counters,
+        TIME_RESOLUTION_T bucket_width,
+        float max_window_seconds)
+  : m_counters(counters),
+    m_stride(0),
+    m_bucket_width(bucket_width.count()),
+    m_max_window(SecondsToTicks(max_window_seconds)),
+    m_newest(INT64_MIN),
+    m_first_sample(NO_SAMPLE)
+  {
+    if (counters == 0)
+      throw std::invalid_argument("FPSEstimatorBank: Counter count must be "
+                                  "positive");
+    if (m_bucket_width <= 0 || max_window_seconds <= 0.f)
+      throw std::invalid_argument("FPSEstimatorBank: Bucket width and window "
+                                  "must be positive");
+    const std::size_t per_line = CACHE_LINE_BYTES/sizeof(uint32_t);
+    m_stride = (counters + per_line-1) / per_line * per_line;
+
+    /// One extra bucket for the partially covered oldest one
+    const std::size_t buckets = static_cast<std::size_t>(
+        (m_max_window + m_bucket_width-1) / m_bucket_width) + 1;
+    std::vector<std::atomic<uint32_t> > live(buckets*m_stride);
+    m_live.swap(live);
+    m_frozen.assign(buckets*m_stride, 0);
+    m_buckets.assign(buckets, INT64_MIN);
+    m_totals.assign(m_stride, 0);
+    Reset();
+  }
+
+  /// Ring slot of a bucket
+  template <typename ClockT>
+  std::size_t BasicFPSEstimatorBank<ClockT>::Index(int64_t bucket) const
+  {
+    const int64_t size = static_cast<int64_t>(m_buckets.size());
+    return static_cast<std::size_t>(((bucket % size) + size) % size);
+  }
+
+  /// Make a slot hold a bucket, with zero counts
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::Claim(std::size_t index, int64_t bucket)
+  {
+    const std::size_t begin = index*m_stride;
+    /// Whatever is left in the live row belongs to an expired bucket
+    for (std::size_t i = begin; i < begin+m_stride; ++i)
+      m_live[i].store(0, std::memory_order_relaxed);
+    std::fill(m_frozen.begin()+begin, m_frozen.begin()+begin+m_stride, 0u);
+    m_buckets[index] = bucket;
+  }
+
+  /**
+   * Make a bucket the newest one
+   *
+   * The new bucket is published before the previous newest one's live row
+   * is emptied, both sequentially consistent: a producer whose increment
+   * lands in that row after it was emptied is bound to see the new value
+   * of m_newest afterwards, and then folds its increment itself.
+   */
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::Advance(int64_t bucket)
+  {
+    const int64_t previous = m_newest.load(std::memory_order_relaxed);
+    Claim(Index(bucket), bucket);
+    m_newest.store(bucket, std::memory_order_seq_cst);
+    if (previous == INT64_MIN ||
+        previous <= bucket - static_cast<int64_t>(m_buckets.size()))
+      return;
+    const std::size_t begin = Index(previous)*m_stride;
+    for (std::size_t i = begin; i < begin+m_stride; ++i)
+      m_frozen[i] += m_live[i].exchange(0, std::memory_order_seq_cst);
+  }
+
+  /// Add samples to a bucket that is not newest
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::AddLocked(int64_t bucket,
+                                                std::size_t counter,
+                                                uint32_t count)
+  {
+    const int64_t newest = m_newest.load(std::memory_order_relaxed);
+    if (bucket > newest)
+      Advance(bucket);
+    const std::size_t index = Index(bucket);
+    if (bucket >= newest) {
+      m_live[index*m_stride+counter].fetch_add(count,
+                                               std::memory_order_relaxed);
+      return;
+    }
+    if (bucket <= newest - static_cast<int64_t>(m_buckets.size()))
+      /// Too old for the ring
+      return;
+    if (m_buckets[index] < bucket)
+      Claim(index, bucket);
+    m_frozen[index*m_stride+counter] += count;
+  }
+
+  /// Add a sample
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::AddSample(std::size_t counter)
+  {
+    AddSamples(counter, 1, ClockT::Now());
+  }
+
+  /// Add a sample with an externally measured time point
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::AddSample(std::size_t counter,
+                                                const TIME_POINT_T& when)
+  {
+    AddSamples(counter, 1, when);
+  }
+
+  /// Add "count" samples that all happened at "when"
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::AddSamples(std::size_t counter,
+                                                 std::size_t count,
+                                                 const TIME_POINT_T& when)
+  {
+    if (count == 0)
+      return;
+    const int64_t ticks = TicksSinceEpoch(when);
+    const int64_t bucket = FloorDivide(ticks, m_bucket_width);
+    const uint32_t added = static_cast<uint32_t>(count);
+    StoreMinimum(m_first_sample, ticks);
+
+    if (m_newest.load(std::memory_order_seq_cst) == bucket) {
+      /// Fast path: the newest bucket's live row
+      const std::size_t index = Index(bucket);
+      std::atomic<uint32_t>& live = m_live[index*m_stride+counter];
+      live.fetch_add(added, std::memory_order_seq_cst);
+      if (m_newest.load(std::memory_order_seq_cst) == bucket)
+        return;
+      /// The row may have been folded before the increment landed
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      if (m_buckets[index] == bucket)
+        m_frozen[index*m_stride+counter] +=
+            live.exchange(0, std::memory_order_relaxed);
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_rollover__mutex);
+    AddLocked(bucket, counter, added);
+  }
+
+  /**
+   * Sum up the window's buckets
+   *
+   * @returns FALSE if there is not enough data for the window
+   */
+  template <typename ClockT>
+  bool BasicFPSEstimatorBank<ClockT>::Sweep(float window_seconds,
+                                            float* sums)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (window > m_max_window ||
+        m_first_sample.load(std::memory_order_relaxed) > now-window)
+      return false;
+    const int64_t first = FloorDivide(now-window, m_bucket_width);
+    const int64_t last = FloorDivide(now, m_bucket_width);
+    /// Only the part of the oldest bucket after the window start is inside
+    const float partial = static_cast<float>(
+        static_cast<double>((first+1)*m_bucket_width - (now-window)) /
+        m_bucket_width);
+
+    std::lock_guard<std::mutex> lock(m_rollover__mutex);
+    uint32_t* totals = &m_totals[0];
+    const std::size_t stride = m_stride;
+    std::fill(totals, totals+stride, 0u);
+    const uint32_t* oldest = NULL;
+    for (int64_t bucket = first; bucket <= last; ++bucket) {
+      const std::size_t index = Index(bucket);
+      if (m_buckets[index] != bucket)
+        continue;
+      const uint32_t* row = &m_frozen[index*stride];
+      if (bucket == first) {
+        oldest = row;
+        continue;
+      }
+      for (std::size_t i = 0; i < stride; ++i)
+        totals[i] += row[i];
+    }
+
+    const std::size_t counters = m_counters;
+    if (oldest) {
+      for (std::size_t i = 0; i < counters; ++i)
+        sums[i] = static_cast<float>(totals[i]) +
+                  partial*static_cast<float>(oldest[i]);
+    } else {
+      for (std::size_t i = 0; i < counters; ++i)
+        sums[i] = static_cast<float>(totals[i]);
+    }
+
+    /// The newest bucket is still being written to
+    const int64_t newest = m_newest.load(std::memory_order_relaxed);
+    if (newest >= first && newest <= last) {
+      const std::atomic<uint32_t>* live = &m_live[Index(newest)*stride];
+      const float weight = (newest == first) ? partial : 1.f;
+      for (std::size_t i = 0; i < counters; ++i)
+        sums[i] += weight*static_cast<float>(
+                       live[i].load(std::memory_order_relaxed));
+    }
+    return true;
+  }
+
+  /**
+   * Estimate the rates of all counters over a given window
+   *
+   * @param window_seconds Number of past seconds over which to measure
+   * @param rates Receives Size() rates
+   */
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::Rates(float window_seconds,
+                                            float* rates)
+  {
+    if (!Sweep(window_seconds, rates)) {
+      std::fill(rates, rates+m_counters, -1.f);
+      return;
+    }
+    const float scale = 1.f / window_seconds;
+    for (std::size_t i = 0; i < m_counters; ++i)
+      rates[i] *= scale;
+  }
+
+  /// Vector version of Rates()
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::Rates(float window_seconds,
+                                            std::vector<float>& rates)
+  {
+    rates.resize(m_counters);
+    Rates(window_seconds, &rates[0]);
+  }
+
+  /**
+   * Estimate the rate of a single counter
+   *
+   * @param counter Counter to estimate
+   * @param window_seconds Number of past seconds over which to measure
+   */
+  template <typename ClockT>
+  float BasicFPSEstimatorBank<ClockT>::FPS(std::size_t counter,
+                                           float window_seconds)
+  {
+    const int64_t now = TicksSinceEpoch(ClockT::Now());
+    const int64_t window = SecondsToTicks(window_seconds);
+    if (window > m_max_window ||
+        m_first_sample.load(std::memory_order_relaxed) > now-window)
+      return -1.f;
+    const int64_t first = FloorDivide(now-window, m_bucket_width);
+    const int64_t last = FloorDivide(now, m_bucket_width);
+
+    std::lock_guard<std::mutex> lock(m_rollover__mutex);
+    const int64_t newest = m_newest.load(std::memory_order_relaxed);
+    double sum = 0.;
+    for (int64_t bucket = first; bucket <= last; ++bucket) {
+      const std::size_t index = Index(bucket);
+      if (m_buckets[index] != bucket)
+        continue;
+      const std::size_t i = index*m_stride+counter;
+      double count = m_frozen[i];
+      if (bucket == newest)
+        count += m_live[i].load(std::memory_order_relaxed);
+      if (bucket == first)
+        sum += count * ((first+1)*m_bucket_width - (now-window)) /
+               m_bucket_width;
+      else
+        sum += count;
+    }
+    return static_cast<float>(sum / window_seconds);
+  }
+
+  /// Reset the instance
+  template <typename ClockT>
+  void BasicFPSEstimatorBank<ClockT>::Reset()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_rollover__mutex);
+      for (std::size_t i = 0; i < m_live.size(); ++i)
+        m_live[i].store(0, std::memory_order_relaxed);
+      std::fill(m_frozen.begin(), m_frozen.end(), 0u);
+      std::fill(m_buckets.begin(), m_buckets.end(), INT64_MIN);
+      m_newest.store(INT64_MIN, std::memory_order_seq_cst);
+    }
+    m_first_sample.store(NO_SAMPLE, std::memory_order_relaxed);
+
+    #ifdef DEBUG_MODE
+      std::cout << "FPSEstimator: Resetting..\n";
+    #endif
+  }
+
+  
+}  // namespace FramesPerSecond
 
 
 
@@ -411,6 +5297,10 @@ namespace FramesPerSecond {
 #undef THREAD_SAFE
 #endif
 
+#ifdef FRAMESPERSECOND_HAVE_TSC
+#undef FRAMESPERSECOND_HAVE_TSC
+#endif
+
 
 #endif  // FRAMESPERSECOND_H__
 